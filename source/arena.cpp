@@ -0,0 +1,22 @@
+// Local headers
+#include "arena.hpp"
+#include "unique_table.hpp"
+
+namespace fermat {
+
+ExpressionArena::ExpressionArena(size_t initial)
+        : upstream { initial },
+        unique { std::make_unique <UniqueTable> (this, 1) } {}
+
+// NOTE: The table is released before the memory it refers to
+ExpressionArena::~ExpressionArena() = default;
+
+void ExpressionArena::release()
+{
+        unique->clear();
+        upstream.release();
+        allocations = 0;
+        bytes = 0;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// Standard headers
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace fermat {
+
+struct UniqueTable;
+
+// Bump allocator for expression nodes; everything allocated from an arena is
+// released at once when the arena is destroyed (or released), so the arena
+// must outlive every operand that refers to its nodes
+struct ExpressionArena : std::pmr::memory_resource {
+        std::pmr::monotonic_buffer_resource upstream;
+
+        // Nodes of the arena are interned separately
+        std::unique_ptr <UniqueTable> unique;
+
+        // Statistics
+        size_t allocations = 0;
+        size_t bytes = 0;
+
+        ExpressionArena(size_t initial = 4096);
+        ~ExpressionArena();
+
+        ExpressionArena(const ExpressionArena &) = delete;
+        ExpressionArena &operator=(const ExpressionArena &) = delete;
+
+        UniqueTable &table() {
+                return *unique;
+        }
+
+        // NOTE: Only valid once no operand refers to the arena anymore
+        void release();
+private:
+        void *do_allocate(size_t size, size_t alignment) override {
+                allocations++;
+                bytes += size;
+                return upstream.allocate(size, alignment);
+        }
+
+        // Memory is reclaimed in bulk
+        void do_deallocate(void *, size_t, size_t) override {}
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+                return this == &other;
+        }
+};
+
+}
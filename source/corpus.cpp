@@ -0,0 +1,148 @@
+// Standard headers
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <thread>
+
+// Local headers
+#include "corpus.hpp"
+#include "expr.hpp"
+#include "mapped_file.hpp"
+
+namespace fermat {
+
+// Chunks are byte ranges which start and end on line boundaries
+struct corpus_chunk {
+        size_t begin;
+        size_t end;
+        size_t first_line = 0;
+        size_t lines = 0;
+};
+
+static std::vector <corpus_chunk> split_chunks(std::string_view text, size_t target)
+{
+        std::vector <corpus_chunk> chunks;
+
+        size_t begin = 0;
+        while (begin < text.size()) {
+                size_t end = std::min(begin + target, text.size());
+
+                // Extend the chunk to the end of the current line
+                if (end < text.size()) {
+                        const void *nl = std::memchr(text.data() + end, '\n', text.size() - end);
+                        end = nl ? static_cast <const char *> (nl) - text.data() + 1 : text.size();
+                }
+
+                chunks.push_back({ begin, end });
+                begin = end;
+        }
+
+        return chunks;
+}
+
+// Runs the function on every index with a fixed set of workers
+template <typename F>
+static void parallel_for(size_t count, size_t threads, const F &ftn)
+{
+        std::atomic <size_t> next = 0;
+
+        auto worker = [&](size_t id) {
+                size_t i;
+                while ((i = next.fetch_add(1)) < count)
+                        ftn(id, i);
+        };
+
+        std::vector <std::thread> pool;
+        for (size_t t = 1; t < threads; t++)
+                pool.emplace_back(worker, t);
+
+        worker(0);
+        for (std::thread &thread : pool)
+                thread.join();
+}
+
+ParsedCorpus parse_corpus(std::string_view text, size_t threads)
+{
+        if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+
+        // Roughly four chunks per thread, but not too small
+        size_t target = std::max <size_t> (text.size() / (4 * threads), 1 << 16);
+        std::vector <corpus_chunk> chunks = split_chunks(text, target);
+        threads = std::max <size_t> (1, std::min(threads, chunks.size()));
+
+        // First pass counts lines so that roots can be placed in input order
+        parallel_for(chunks.size(), threads, [&](size_t, size_t i) {
+                corpus_chunk &chunk = chunks[i];
+                chunk.lines = std::count(text.begin() + chunk.begin, text.begin() + chunk.end, '\n');
+                if (chunk.end == text.size() && text.back() != '\n')
+                        chunk.lines++;
+        });
+
+        size_t lines = 0;
+        for (corpus_chunk &chunk : chunks) {
+                chunk.first_line = lines;
+                lines += chunk.lines;
+        }
+
+        ParsedCorpus corpus;
+        corpus.roots.resize(lines);
+
+        // One arena and error list per worker
+        std::vector <std::vector <ParseError>> errors(threads);
+        for (size_t t = 0; t < threads; t++)
+                corpus.arenas.emplace_back(std::make_unique <ExpressionArena> (1 << 16));
+
+        parallel_for(chunks.size(), threads, [&](size_t id, size_t i) {
+                const corpus_chunk &chunk = chunks[i];
+                ExpressionArena &arena = *corpus.arenas[id];
+
+                std::string error;
+
+                size_t line = chunk.first_line;
+                size_t begin = chunk.begin;
+                while (begin < chunk.end) {
+                        const void *nl = std::memchr(text.data() + begin, '\n', chunk.end - begin);
+                        size_t end = nl ? static_cast <const char *> (nl) - text.data() : chunk.end;
+
+                        std::string_view expression = text.substr(begin, end - begin);
+                        if (!expression.empty() && expression.back() == '\r')
+                                expression.remove_suffix(1);
+
+                        bool blank = std::all_of(expression.begin(), expression.end(),
+                                [](unsigned char c) { return std::isspace(c); });
+
+                        if (!blank) {
+                                error.clear();
+                                std::optional <Operand> opd = detail::parse(expression, &arena, error);
+                                if (opd)
+                                        corpus.roots[line] = *opd;
+                                else
+                                        errors[id].push_back({ line, error });
+                        }
+
+                        begin = end + 1;
+                        line++;
+                }
+        });
+
+        for (std::vector <ParseError> &list : errors)
+                corpus.errors.insert(corpus.errors.end(), list.begin(), list.end());
+
+        std::sort(corpus.errors.begin(), corpus.errors.end(),
+                [](const ParseError &a, const ParseError &b) {
+                        return a.line < b.line;
+                }
+        );
+
+        return corpus;
+}
+
+ParsedCorpus parse_corpus_file(const std::string &path, size_t threads)
+{
+        MappedFile file(path);
+        return parse_corpus(file.view(), threads);
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Standard headers
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Local headers
+#include "arena.hpp"
+#include "operand.hpp"
+
+namespace fermat {
+
+struct ParseError {
+        size_t line;
+        std::string message;
+};
+
+// Result of parsing a newline delimited corpus; roots are in input order, one
+// per line, and are blank for empty lines or lines that failed to parse
+struct ParsedCorpus {
+        // NOTE: Declared first so that the arenas outlive the roots
+        std::vector <std::unique_ptr <ExpressionArena>> arenas;
+
+        std::vector <Operand> roots;
+        std::vector <ParseError> errors;
+};
+
+// Parses every line in parallel; threads = 0 uses all hardware threads
+ParsedCorpus parse_corpus(std::string_view, size_t threads = 0);
+
+// Same as above, but memory maps the file first
+ParsedCorpus parse_corpus_file(const std::string &, size_t threads = 0);
+
+}
@@ -7,7 +7,9 @@
 
 namespace fermat {
 
-struct logging_stream {} lout;
+struct logging_stream {};
+
+inline logging_stream lout;
 
 #ifdef FERMAT_DEBUGGING
 
@@ -18,6 +20,8 @@ constexpr logging_stream &operator<<(logging_stream &lout, const T &t)
         return lout;
 }
 
+#define FERMAT_LOG(...) do { fermat::lout << __VA_ARGS__; } while (0)
+
 #else
 
 template <typename T>
@@ -26,6 +30,10 @@ constexpr logging_stream &operator<<(logging_stream &lout, const T &)
         return lout;
 }
 
+// NOTE: Discarded, so that the arguments (e.g. printed expressions,
+// which are as large as the expressions) are not even evaluated
+#define FERMAT_LOG(...) do { if constexpr (false) fermat::lout << __VA_ARGS__; } while (0)
+
 #endif
 
 }
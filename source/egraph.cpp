@@ -0,0 +1,573 @@
+// Standard headers
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <unordered_set>
+
+// Local headers
+#include "egraph.hpp"
+#include "operation_impl.hpp"
+#include "simplify.hpp"
+
+namespace fermat {
+
+bool ENode::operator==(const ENode &other) const
+{
+        if (kind != other.kind || op != other.op || children != other.children)
+                return false;
+
+        if (leaf.is_blank() || other.leaf.is_blank())
+                return leaf.is_blank() && other.leaf.is_blank();
+
+        return detail::cmp(leaf, other.leaf);
+}
+
+size_t ENodeHash::operator()(const ENode &node) const
+{
+        uint64_t seed = detail::mix(node.kind, node.op ? node.op->id : -1);
+        if (!node.leaf.is_blank())
+                seed = detail::mix(seed, detail::fingerprint(node.leaf));
+
+        for (EClassId child : node.children)
+                seed = detail::mix(seed, child);
+
+        return seed;
+}
+
+EClassId EGraph::find(EClassId id) const
+{
+        EClassId root = id;
+        while (parents[root] != root)
+                root = parents[root];
+
+        while (parents[id] != root)
+                id = std::exchange(parents[id], root);
+
+        return root;
+}
+
+void EGraph::canonicalize(ENode &node) const
+{
+        for (EClassId &child : node.children)
+                child = find(child);
+
+        if (detail::flattens(node.op))
+                std::sort(node.children.begin(), node.children.end());
+}
+
+EClassId EGraph::add(ENode node)
+{
+        canonicalize(node);
+
+        auto it = memo.find(node);
+        if (it != memo.end())
+                return find(it->second);
+
+        EClassId id = classes.size();
+        parents.push_back(id);
+        classes.emplace_back();
+
+        for (EClassId child : node.children)
+                classes[child].parents.push_back({ node, id });
+
+        if (node.leaf.is_constant())
+                classes[id].constant = node.leaf;
+
+        classes[id].nodes.push_back(node);
+        memo.emplace(std::move(node), id);
+        nodes++;
+
+        return id;
+}
+
+EClassId EGraph::add(const Operand &opd)
+{
+        if (opd.is_constant() || opd.is_variable())
+                return leaf(opd);
+
+        if (opd.is_binary_grouping()) {
+                const BinaryGrouping &bg = opd.as_binary_grouping();
+                if (bg.degenerate())
+                        return add(bg.opda);
+
+                return apply(bg.op, { add(bg.opda), add(bg.opdb) });
+        }
+
+        if (opd.is_nary_grouping()) {
+                const NaryGrouping &ng = opd.as_nary_grouping();
+
+                std::vector <EClassId> children;
+                for (const Operand &item : ng.opds)
+                        children.push_back(add(item));
+
+                return apply(ng.op, std::move(children));
+        }
+
+        throw std::runtime_error("EGraph: unsupported operand type, opd=<" + opd.string() + ">");
+}
+
+EClassId EGraph::leaf(const Operand &opd)
+{
+        int32_t kind = opd.is_constant() ? opd.type : int32_t(eVariable);
+        return add(ENode { kind, nullptr, opd, {} });
+}
+
+// NOTE: Flat operations of a single operand are the operand itself
+EClassId EGraph::apply(Operation *op, std::vector <EClassId> children)
+{
+        if (!detail::flattens(op))
+                return add(ENode { eBinaryGrouping, op, {}, std::move(children) });
+
+        if (children.size() == 1)
+                return children[0];
+
+        return add(ENode { eNaryGrouping, op, {}, std::move(children) });
+}
+
+// Exact constants are the same only if they are identical; reals are
+// compared by value, and all NaNs are the same
+static bool same_constant(const Operand &a, const Operand &b)
+{
+        if (detail::cmp(a, b))
+                return true;
+
+        if (!a.is_real() && !b.is_real())
+                return false;
+
+        Real x = detail::real(a);
+        Real y = detail::real(b);
+        return x == y || (x != x && y != y);
+}
+
+bool EGraph::merge(EClassId a, EClassId b)
+{
+        a = find(a);
+        b = find(b);
+        if (a == b)
+                return false;
+
+        const std::optional <Operand> &ca = classes[a].constant;
+        const std::optional <Operand> &cb = classes[b].constant;
+        if (ca && cb && !same_constant(*ca, *cb)) {
+                conflicts++;
+                return false;
+        }
+
+        // Fewer parents to move
+        if (classes[a].parents.size() < classes[b].parents.size())
+                std::swap(a, b);
+
+        parents[b] = a;
+
+        EClass &into = classes[a];
+        EClass &from = classes[b];
+
+        into.nodes.insert(into.nodes.end(), from.nodes.begin(), from.nodes.end());
+        into.parents.insert(into.parents.end(), from.parents.begin(), from.parents.end());
+        if (!into.constant)
+                into.constant = from.constant;
+
+        from = {};
+
+        pending.push_back(a);
+        merges++;
+
+        return true;
+}
+
+// Parents which became identical after a merge are merged in turn
+void EGraph::repair(EClassId id)
+{
+        std::vector <std::pair <ENode, EClassId>> stale = std::move(classes[id].parents);
+        classes[id].parents.clear();
+
+        for (auto &[node, parent] : stale) {
+                memo.erase(node);
+                canonicalize(node);
+                memo[node] = find(parent);
+        }
+
+        std::unordered_map <ENode, EClassId, ENodeHash> unique;
+        for (auto &[node, parent] : stale) {
+                auto [it, inserted] = unique.try_emplace(node, find(parent));
+                if (!inserted) {
+                        merge(it->second, parent);
+                        it->second = find(parent);
+                }
+        }
+
+        EClass &cls = classes[find(id)];
+        for (auto &[node, parent] : unique)
+                cls.parents.push_back({ node, find(parent) });
+
+        // Nodes of merged classes may now be duplicates
+        std::unordered_set <ENode, ENodeHash> nodes;
+        for (ENode &node : cls.nodes) {
+                canonicalize(node);
+                nodes.insert(std::move(node));
+        }
+
+        cls.nodes.assign(nodes.begin(), nodes.end());
+}
+
+void EGraph::rebuild()
+{
+        while (!pending.empty()) {
+                std::vector <EClassId> todo = std::move(pending);
+                pending.clear();
+
+                for (EClassId &id : todo)
+                        id = find(id);
+
+                std::sort(todo.begin(), todo.end());
+                todo.erase(std::unique(todo.begin(), todo.end()), todo.end());
+
+                for (EClassId id : todo)
+                        repair(find(id));
+        }
+}
+
+// Mirrors unfold; x - y is x + (-1)*y, and x/y is x*y^-1
+void EGraph::inverses(EClassId id, const ENode &node)
+{
+        if (node.kind != eBinaryGrouping)
+                return;
+
+        EClassId a = node.children[0];
+        EClassId b = node.children[1];
+
+        if (node.op->id == op_sub->id)
+                merge(id, apply(op_add, { a, apply(op_mul, { leaf(-1ll), b }) }));
+        else if (node.op->id == op_div->id)
+                merge(id, apply(op_mul, { a, apply(op_exp, { b, leaf(-1ll) }) }));
+}
+
+// Mirrors the constant folding of simplification_fold
+void EGraph::fold(EClassId id, const ENode &node)
+{
+        if (node.kind == eBinaryGrouping) {
+                std::optional <Operand> a = classes[find(node.children[0])].constant;
+                std::optional <Operand> b = classes[find(node.children[1])].constant;
+                if (!a || !b)
+                        return;
+
+                if (node.op->id == op_div->id && b->is_zero())
+                        return;
+
+                merge(id, leaf(opftn(node.op, *a, *b)));
+                return;
+        }
+
+        if (node.kind != eNaryGrouping)
+                return;
+
+        std::vector <Operand> constants;
+        std::vector <EClassId> rest;
+        for (EClassId child : node.children) {
+                if (std::optional <Operand> constant = classes[find(child)].constant)
+                        constants.push_back(*constant);
+                else
+                        rest.push_back(child);
+        }
+
+        if (constants.empty())
+                return;
+
+        Operand constant = constants[0];
+        for (size_t i = 1; i < constants.size(); i++)
+                constant = opftn(node.op, constant, constants[i]);
+
+        if (node.op->id == op_mul->id && constant.is_zero()) {
+                merge(id, leaf(constant));
+                return;
+        }
+
+        // Nothing to combine
+        bool identity = detail::is_identity(node.op, constant);
+        if (constants.size() == 1 && !identity)
+                return;
+
+        if (!identity || rest.empty())
+                rest.push_back(leaf(constant));
+
+        merge(id, apply(node.op, std::move(rest)));
+}
+
+// Mirrors simplification_aggressive; zero bases are only folded
+// for exponents which are not negative, since 0^-1 is infinite
+void EGraph::identities(EClassId id, const ENode &node)
+{
+        if (node.kind != eBinaryGrouping || node.op->id != op_exp->id)
+                return;
+
+        EClassId base = node.children[0];
+        EClassId exponent = node.children[1];
+
+        std::optional <Operand> a = classes[find(base)].constant;
+        std::optional <Operand> b = classes[find(exponent)].constant;
+
+        if (b && b->is_zero())
+                merge(id, leaf(1ll));
+        else if (b && b->is_one())
+                merge(id, base);
+        else if (a && a->is_zero() && !(b && detail::real(*b) < 0))
+                merge(id, leaf(0ll));
+        else if (a && a->is_one())
+                merge(id, leaf(1ll));
+        else if (b && b->is_integer() && b->i < 0)
+                merge(id, apply(op_div, { leaf(1ll), apply(op_exp, { base, leaf(-b->i) }) }));
+}
+
+// Associativity; splices the first nested grouping of the same operation
+void EGraph::flatten(EClassId id, const ENode &node)
+{
+        if (node.kind != eNaryGrouping)
+                return;
+
+        for (size_t i = 0; i < node.children.size(); i++) {
+                EClassId child = find(node.children[i]);
+                for (const ENode &nested : classes[child].nodes) {
+                        if (nested.kind != eNaryGrouping || nested.op != node.op)
+                                continue;
+
+                        // Skip groupings which contain themselves (e.g. x = x + 0)
+                        bool cyclic = std::any_of(nested.children.begin(), nested.children.end(),
+                                [&](EClassId c) { return find(c) == child; });
+                        if (cyclic)
+                                continue;
+
+                        std::vector <EClassId> children = node.children;
+                        children.erase(children.begin() + i);
+                        children.insert(children.end(), nested.children.begin(), nested.children.end());
+
+                        merge(id, apply(node.op, std::move(children)));
+                        return;
+                }
+        }
+}
+
+// Mirrors simplification_gather; combines c1*x + c2*x into (c1 + c2)*x,
+// and x^a * x^b into x^(a + b), for constant coefficients and exponents
+void EGraph::gather(EClassId id, const ENode &node)
+{
+        if (node.kind != eNaryGrouping)
+                return;
+
+        bool sum = (node.op->id == op_add->id);
+        if (!sum && node.op->id != op_mul->id)
+                return;
+
+        // Terms by their bases, in order of appearance
+        std::map <std::vector <EClassId>, Operand> factors;
+        std::vector <std::vector <EClassId>> order;
+        std::vector <EClassId> constants;
+
+        bool combined = false;
+        for (EClassId child : node.children) {
+                child = find(child);
+
+                const EClass &cls = classes[child];
+                if (cls.constant) {
+                        constants.push_back(child);
+                        continue;
+                }
+
+                std::vector <EClassId> base { child };
+                Operand factor = 1ll;
+                for (const ENode &n : cls.nodes) {
+                        if (sum && n.kind == eNaryGrouping && n.op->id == op_mul->id) {
+                                auto constant = std::find_if(n.children.begin(), n.children.end(),
+                                        [&](EClassId c) { return classes[find(c)].constant.has_value(); });
+                                if (constant == n.children.end())
+                                        continue;
+
+                                factor = *classes[find(*constant)].constant;
+                                base.clear();
+                                for (auto it = n.children.begin(); it != n.children.end(); it++) {
+                                        if (it != constant)
+                                                base.push_back(find(*it));
+                                }
+
+                                std::sort(base.begin(), base.end());
+                                break;
+                        }
+
+                        if (!sum && n.kind == eBinaryGrouping && n.op->id == op_exp->id) {
+                                std::optional <Operand> exponent = classes[find(n.children[1])].constant;
+                                if (!exponent)
+                                        continue;
+
+                                factor = *exponent;
+                                base = { find(n.children[0]) };
+                                break;
+                        }
+                }
+
+                auto [it, inserted] = factors.try_emplace(base, factor);
+                if (inserted) {
+                        order.push_back(base);
+                } else {
+                        it->second = opftn(op_add, it->second, factor);
+                        combined = true;
+                }
+        }
+
+        if (!combined)
+                return;
+
+        std::vector <EClassId> children = constants;
+        for (const std::vector <EClassId> &base : order) {
+                Operand factor = factors[base];
+                if (factor.is_zero())
+                        continue;
+
+                if (sum) {
+                        std::vector <EClassId> term = base;
+                        if (!factor.is_one())
+                                term.push_back(leaf(factor));
+
+                        children.push_back(apply(op_mul, std::move(term)));
+                } else if (factor.is_one()) {
+                        children.push_back(base[0]);
+                } else {
+                        children.push_back(apply(op_exp, { base[0], leaf(factor) }));
+                }
+        }
+
+        if (children.empty())
+                children.push_back(leaf(detail::identity(node.op)));
+
+        merge(id, apply(node.op, std::move(children)));
+}
+
+void EGraph::rewrite(EClassId id, const ENode &node)
+{
+        inverses(id, node);
+        fold(id, node);
+        identities(id, node);
+        flatten(id, node);
+        gather(id, node);
+}
+
+void EGraph::saturate(const SaturationLimits &limits)
+{
+        for (size_t i = 0; i < limits.iterations; i++) {
+                size_t nodes_before = nodes;
+                size_t merges_before = merges;
+
+                // NOTE: Rules are matched against a snapshot, since they add nodes
+                std::vector <std::pair <EClassId, ENode>> matches;
+                for (EClassId id = 0; id < classes.size(); id++) {
+                        if (find(id) != id)
+                                continue;
+
+                        for (const ENode &node : classes[id].nodes)
+                                matches.push_back({ id, node });
+                }
+
+                for (auto &[id, node] : matches) {
+                        if (nodes > limits.nodes)
+                                break;
+
+                        canonicalize(node);
+                        rewrite(find(id), node);
+                }
+
+                rebuild();
+                iterations++;
+
+                // Saturated
+                if (nodes == nodes_before && merges == merges_before)
+                        break;
+
+                if (nodes > limits.nodes)
+                        break;
+        }
+}
+
+Operand EGraph::extract(EClassId root) const
+{
+        // Perceptual complexity, then size to break ties
+        using cost = std::pair <int64_t, size_t>;
+        constexpr cost infinite { std::numeric_limits <int64_t>::max(), 0 };
+
+        std::vector <cost> best(classes.size(), infinite);
+        std::vector <const ENode *> choice(classes.size(), nullptr);
+
+        // Costs only decrease, so this terminates
+        bool changed = true;
+        while (changed) {
+                changed = false;
+
+                for (EClassId id = 0; id < classes.size(); id++) {
+                        if (find(id) != id)
+                                continue;
+
+                        for (const ENode &node : classes[id].nodes) {
+                                cost c { 0, 1 };
+                                if (!node.leaf.is_blank())
+                                        c.first = detail::perceptual_complexity(node.leaf);
+
+                                bool finite = true;
+                                for (EClassId child : node.children) {
+                                        const cost &k = best[find(child)];
+                                        if (k == infinite) {
+                                                finite = false;
+                                                break;
+                                        }
+
+                                        c.first += k.first;
+                                        c.second += k.second;
+                                }
+
+                                if (finite && (best[id] == infinite || c < best[id])) {
+                                        best[id] = c;
+                                        choice[id] = &node;
+                                        changed = true;
+                                }
+                        }
+                }
+        }
+
+        auto build = [&](auto &self, EClassId id) -> Operand {
+                const ENode *node = choice[find(id)];
+                if (!node)
+                        throw std::runtime_error("EGraph: no finite term to extract");
+
+                if (!node->leaf.is_blank())
+                        return node->leaf;
+
+                std::vector <Operand> opds;
+                for (EClassId child : node->children)
+                        opds.push_back(self(self, child));
+
+                if (node->kind == eBinaryGrouping)
+                        return { new_ <BinaryGrouping> (node->op, opds[0], opds[1]), eBinaryGrouping };
+
+                detail::canonicalize(node->op, opds);
+                return { new_ <NaryGrouping> (node->op, opds), eNaryGrouping };
+        };
+
+        return build(build, root);
+}
+
+Operand simplify_saturated(const Operand &opd, const SaturationLimits &limits)
+{
+        if (opd.is_constant() || opd.is_blank())
+                return opd;
+
+        EGraph egraph;
+        EClassId root = egraph.add(detail::canonical(opd));
+        egraph.saturate(limits);
+
+        // NOTE: A conflict means some class was equated with two different
+        // constants (e.g. 0*x, where x is 0^-1), so its terms cannot be
+        // trusted; the rewriting simplifier folds the constants first
+        if (egraph.conflicts)
+                return simplify(opd, SimplifyOptions {});
+
+        return egraph.extract(root);
+}
+
+}
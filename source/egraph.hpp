@@ -0,0 +1,104 @@
+#pragma once
+
+// Standard headers
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Local headers
+#include "operand.hpp"
+
+namespace fermat {
+
+using EClassId = uint32_t;
+
+// Term whose operands are equivalence classes; constants and variables
+// are leaves, and operands of commutative and associative operations
+// are kept sorted, so that reorderings are the same node
+struct ENode {
+        int32_t kind;
+        Operation *op = nullptr;
+        Operand leaf;
+        std::vector <EClassId> children;
+
+        bool operator==(const ENode &) const;
+};
+
+struct ENodeHash {
+        size_t operator()(const ENode &) const;
+};
+
+struct EClass {
+        std::vector <ENode> nodes;
+
+        // Nodes which refer to this class, and their classes
+        std::vector <std::pair <ENode, EClassId>> parents;
+
+        // Set if the class is equal to a constant
+        std::optional <Operand> constant;
+};
+
+// Bounds the cost of saturation, which may not terminate otherwise
+struct SaturationLimits {
+        size_t iterations = 8;
+        size_t nodes = 1 << 14;
+};
+
+// Equality saturation; rewrites only ever add equivalences, so the order in
+// which they are applied does not matter, and cycles (e.g. x^-1 and 1/x)
+// are harmless. The simplest term of a class is extracted at the end
+struct EGraph {
+        // Union-find over class ids; mutable for path compression
+        mutable std::vector <EClassId> parents;
+        std::vector <EClass> classes;
+
+        // Canonical nodes to their classes
+        std::unordered_map <ENode, EClassId, ENodeHash> memo;
+
+        // Classes whose parents need to be repaired
+        std::vector <EClassId> pending;
+
+        // Statistics
+        size_t nodes = 0;
+        size_t merges = 0;
+        size_t conflicts = 0;
+        size_t iterations = 0;
+
+        EClassId find(EClassId) const;
+
+        EClassId add(ENode);
+        EClassId add(const Operand &);
+
+        // Returns whether the classes were distinct and merged; classes
+        // equal to different constants (e.g. 0 and 0^-1) are never
+        // merged, but counted as conflicts instead
+        bool merge(EClassId, EClassId);
+
+        // Restores congruence closure after merges
+        void rebuild();
+
+        // Applies the rewrite rules until nothing changes or a limit is hit
+        void saturate(const SaturationLimits & = {});
+
+        // Term of the class with the lowest perceptual complexity
+        Operand extract(EClassId) const;
+private:
+        void canonicalize(ENode &) const;
+        void repair(EClassId);
+
+        EClassId leaf(const Operand &);
+        EClassId apply(Operation *, std::vector <EClassId>);
+
+        void rewrite(EClassId, const ENode &);
+        void inverses(EClassId, const ENode &);
+        void fold(EClassId, const ENode &);
+        void identities(EClassId, const ENode &);
+        void flatten(EClassId, const ENode &);
+        void gather(EClassId, const ENode &);
+};
+
+// Simplification by equality saturation, as an alternative to simplify
+Operand simplify_saturated(const Operand &, const SaturationLimits & = {});
+
+}
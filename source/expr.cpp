@@ -1,13 +1,16 @@
 // Standard headers
+#include <array>
 #include <cassert>
-#include <cmath>
+#include <charconv>
 #include <iostream>
 #include <optional>
 #include <stack>
-#include <unordered_map>
+#include <string_view>
+#include <vector>
 
 // Local headers
 #include "expr.hpp"
+#include "lexer.hpp"
 #include "operand.hpp"
 #include "operation.hpp"
 #include "operation_impl.hpp"
@@ -15,85 +18,145 @@
 namespace fermat {
 
 struct ParsingState {
-        enum {
-                eStart,
-                eInteger,
-                eReal,
-        } state;
-
-        union {
-                Integer i;
-                struct {
-                        Real value;
-                        int point;
-                        int exp;
-                } real;
-        };
+        // Nodes are allocated in the arena if one is provided
+        ExpressionArena *arena;
 
-        std::string buffer;
-        int64_t index;
+        // Set on the first error, after which parsing stops
+        std::string error;
 
-        char current() const {
-                return buffer[index];
+        void fail(const std::string &msg) {
+                if (error.empty())
+                        error = "parsing: " + msg;
         }
 
-        void advance() {
-                index++;
+        template <typename T>
+        using stack = std::stack <T, std::vector <T>>;
+
+        // NOTE: The stacks are reused across parses
+        stack <Operand> &operands;
+        // Operation *current_operation;
+        stack <Operation *> &operations;
+        stack <int64_t> &scopes;
+
+        // Operands of the grouping being reduced
+        std::vector <Operand> &items;
+
+        template <typename T, typename ... Args>
+        Uptr node(Args && ... args) {
+                if (arena)
+                        return arena_new <T> (*arena, std::forward <Args> (args) ...);
+
+                return new_ <T> (std::forward <Args> (args) ...);
         }
 
-        bool end() const {
-                return index >= buffer.size();
+        void push(Operand opd) {
+                operands.push(std::move(opd));
         }
 
-        std::stack <Operand> operands;
-        // Operation *current_operation;
-        std::stack <Operation *> operations;
-        std::stack <int64_t> scopes;
+        // Converts a literal token, which the lexer has
+        // already delimited (e.g. 42, 0.5 or 1.5e-3)
+        void push_literal(TokenKind kind, std::string_view text) {
+                const char *begin = text.data();
+                const char *end = text.data() + text.size();
+
+                if (kind == eTokenInteger) {
+                        Integer i;
+                        auto [last, ec] = std::from_chars(begin, end, i);
+                        if (ec == std::errc {}) {
+                                push(i);
+                                return;
+                        }
 
-        void push(const Operand &opd) {
-                operands.push(opd);
+                        // Integers that do not fit are kept exactly
+                        std::optional <BigInteger> big = BigInteger::decimal(text);
+                        if (ec != std::errc::result_out_of_range || !big) {
+                                fail("invalid integer literal: " + std::string(text));
+                                return;
+                        }
+
+                        push(Rational { *big });
+                        return;
+                }
+
+                // Correctly rounded conversion
+                Real r;
+                auto [last, ec] = std::from_chars(begin, end, r);
+                if (ec != std::errc {} || last != end) {
+                        fail("invalid real literal: " + std::string(text));
+                        return;
+                }
+
+                push(r);
         }
 
-        void push(Operation *op) {
+        // Whether the operation has an operand pending in the scope
+        bool pending() const {
                 bool empty_scope = operations.empty();
                 if (scopes.size() > 0)
                         empty_scope |= (operations.size() <= scopes.top());
 
-                if (empty_scope) {
-                        assert(op);
-                        // std::cout << "op on hold: \'" << op->lexicon << "\'" << std::endl;
-                        operations.push(op);
-                        return;
-                }
-                
-                // if (op)
-                //         std::cout << "op on hold: \'" << op->lexicon << "\'" << std::endl;
+                return !empty_scope;
+        }
 
-                // operations.push(op);
+        // Applies the operation on top of the stack to its operands;
+        // a run of the same flattening operation is applied at once
+        void reduce() {
                 Operation *prev = operations.top();
-                if (!op || prev->priority >= op->priority) {
-                        // std::cout << "pushing op: \'" << prev->lexicon << "\'" << std::endl;
+                operations.pop();
 
-                        // TODO: error msg here...
-                        assert(operands.size() >= 2);
+                size_t count = 2;
+                if (detail::flattens(prev)) {
+                        while (pending() && operations.top() == prev) {
+                                operations.pop();
+                                count++;
+                        }
+                }
+
+                if (operands.size() < count) {
+                        fail("missing operand for \'" + prev->lexicon + "\'");
+                        return;
+                }
 
+                if (!detail::flattens(prev)) {
                         // We can now add the previous operation
                         // safely along with its operands
-                        Operand opda = operands.top();
+                        Operand opda = std::move(operands.top());
                         operands.pop();
 
-                        Operand opdb = operands.top();
+                        Operand opdb = std::move(operands.top());
                         operands.pop();
 
-                        // std::cout << "  opda: " << opda.string() << std::endl;
-                        // std::cout << "  opdb: " << opdb.string() << std::endl;
-
                         // TODO: check to mke sure the operations matches
                         // grouping -- or do we even need to specialize the
                         // groupings? -- yes, it is easier to handle
                         // smlpification and/or differentiation
-                        operands.push({ new_ <BinaryGrouping> (prev, opdb, opda), eBinaryGrouping });
-                        operations.pop();
+                        operands.push({ node <BinaryGrouping> (prev, std::move(opdb), std::move(opda)), eBinaryGrouping });
+                        return;
+                }
+
+                items.resize(count);
+                for (size_t i = count; i-- > 0; ) {
+                        items[i] = std::move(operands.top());
+                        operands.pop();
+                }
+
+                detail::canonicalize(prev, items);
+                operands.push({ node <NaryGrouping> (prev, items), eNaryGrouping });
+                items.clear();
+        }
+
+        void push(Operation *op) {
+                // Apply all pending operations which bind at least as
+                // tightly, except for a run of the same flattening operation
+                while (pending() && error.empty()) {
+                        Operation *prev = operations.top();
+                        if (op && prev->priority < op->priority)
+                                break;
+
+                        if (op == prev && detail::flattens(op))
+                                break;
+
+                        reduce();
                 }
 
                 if (op)
@@ -104,12 +167,12 @@ struct ParsingState {
                 // Flush all operations
                 // TODO: ensure that the number of operations decreases...
                 if (scopes.empty()) {
-                        while (!operations.empty())
+                        while (!operations.empty() && error.empty())
                                 push(nullptr);
                 } else {
                         int64_t stop = scopes.top();
                         // std::cout << "flushing until " << stop << " ops left" << std::endl;
-                        while (!operations.empty() && operations.size() > stop)
+                        while (!operations.empty() && operations.size() > stop && error.empty())
                                 push(nullptr);
 
                         scopes.pop();
@@ -117,150 +180,153 @@ struct ParsingState {
         }
 };
 
-std::optional <Operand> parse(const std::string &expression)
+// Operation lexicon table, indexed by character
+// TODO: later need to populate from everything in a loop, e.g. if
+// custom operations are added
+static const std::array <Operation *, 128> &operator_table()
 {
-        ParsingState ps {
-                .state = ParsingState::eStart,
-                .buffer = expression,
-                .index = 0,
-                // .current_operation = nullptr,
-        };
+        static const std::array <Operation *, 128> table = [] {
+                std::array <Operation *, 128> table {};
+                table['+'] = op_add;
+                table['-'] = op_sub;
+                table['*'] = op_mul;
+                table['/'] = op_div;
+                table['^'] = op_exp;
+                return table;
+        } ();
+
+        return table;
+}
 
-        // Build operation lexicon table
-        // TODO: later need to populate from everything in a loop, e.g. if
-        // custom operations are added
-        std::unordered_map <std::string, OperationId> op_lexicon {
-                { "+", op_add->id },
-                { "-", op_sub->id },
-                { "*", op_mul->id },
-                { "/", op_div->id },
-                { "^", op_exp->id },
-        };
+static Operation *lookup_operator(char c)
+{
+        unsigned char uc = c;
+        return (uc < 128) ? operator_table()[uc] : nullptr;
+}
 
-        auto is_legal_operator = [] (char c) {
-                // NOTE: hard coded for now
-                return c == '+' || c == '-' || c == '*' || c == '/' || c == '^';
-        };
+namespace detail {
 
-        while (!ps.end()) {
-                char c = ps.current();
-                ps.advance();
-
-                if (std::isspace(c))
-                        continue;
-
-                while (true) {
-                        auto old_state = ps.state;
-
-                        switch (ps.state) {
-                        case ParsingState::eStart:
-                                if (std::isdigit(c)) {
-                                        // std::cout << "digit: " << c << std::endl;
-                                        ps.state = ParsingState::eInteger;
-                                        ps.i = 0;
-                                } else if (is_legal_operator(c)) {
-                                        // TODO: mutlicharacter operators?
-                                        OperationId op_id = op_lexicon[std::string(1, c)];
-                                        // operands.push_back(op_id);
-                                        // std::cout << "op: " << op_id << std::endl;
-                                        // ps.current_operation = &g_operations[op_id];
-                                        ps.push(&g_operations[op_id]);
-                                } else if (std::isalpha(c)) {
-                                        // std::cout << "variable: " << c << std::endl;
-                                        // TODO: literal constructor?
-                                        ps.push({ new_ <Variable> (std::string(1, c)), eVariable });
-
-                                        // TODO: permit underscores for variable names
-                                        // and later longer grouped underscores (e.g. y_{3,4})
-                                        // will also need to remember if ay indices are present in the
-                                        // underscores
-                                } else if (c == '(') {
-                                        ps.state = ParsingState::eStart;
-                                        ps.scopes.push(ps.operands.size());
-                                } else if (c == ')') {
-                                        ps.state = ParsingState::eStart;
-                                        ps.flush();
-                                } else if (c == 0) {
-                                        // End
-                                } else {
-                                        throw std::runtime_error("parsing: unexpected character: \'" + std::string(1, c) + "\'");
-                                }
+std::optional <Operand> parse(std::string_view expression, ExpressionArena *arena, std::string &error)
+{
+        // Scratch space, which keeps its capacity between parses
+        struct scratch {
+                ParsingState::stack <Operand> operands;
+                ParsingState::stack <Operation *> operations;
+                ParsingState::stack <int64_t> scopes;
+                std::vector <Operand> items;
+                std::vector <Token> tokens;
+
+                void clear() {
+                        while (!operands.empty())
+                                operands.pop();
+                        while (!operations.empty())
+                                operations.pop();
+                        while (!scopes.empty())
+                                scopes.pop();
 
-                                break;
-                        case ParsingState::eInteger:
-                                if (std::isdigit(c)) {
-                                        // std::cout << "Appending digit: " << c << std::endl;
-                                        ps.i *= 10;
-                                        ps.i += c - '0';
-                                } else if (c == '.') {
-                                        ps.real.value = ps.i;
-                                        ps.real.point = 1;
-                                        ps.real.exp = -1;
-
-                                        ps.state = ParsingState::eReal;
-                                } else {
-                                        // std::cout << "integer: " << ps.i << std::endl;
-                                        ps.push(ps.i);
-                                        ps.state = ParsingState::eStart;
-                                }
+                        items.clear();
+                        tokens.clear();
+                }
+        };
 
-                                break;
-                        case ParsingState::eReal:
-                                if (std::isdigit(c)) {
-                                        // std::cout << "Appending digit: " << c << std::endl;
-                                        // ps.real.value += 10;
-                                        // ps.r += c - '0';
-                                        // ps.r_exp -= 1;
-                                        ps.real.value += (c - '0') * std::pow(10, ps.real.exp);
-                                        ps.real.exp -= 1;
-                                } else if (c == '.') {
-                                        assert(ps.real.point == 1);
-                                        // std::cout << "transfered from int: " << ps.real.value << std::endl;
-                                } else {
-                                        // std::cout << "real: " << ps.r << " * 10^" << ps.r_exp << std::endl;
-                                        // ps.push(ps.r * std::pow(10, ps.r_exp));
-                                        // std::cout << "real: " << ps.real.value << std::endl;
-                                        ps.push(ps.real.value);
-                                        ps.state = ParsingState::eStart;
-                                }
+        static thread_local scratch scratch;
 
-                                break;
-                        default:
-                                throw std::runtime_error("parsing: unsupported state");
-                        }
+        ParsingState ps {
+                .arena = arena,
+                .operands = scratch.operands,
+                .operations = scratch.operations,
+                .scopes = scratch.scopes,
+                .items = scratch.items,
+        };
 
-                        if (old_state != ps.state) {
-                                // std::cout << "relooping...\n";
-                                continue;
-                        }
+        std::vector <Token> &tokens = scratch.tokens;
+        if (!tokenize(expression, tokens, error)) {
+                scratch.clear();
+                return std::nullopt;
+        }
 
-                        // If we at the end of parsing, also reloop
-                        if (ps.end() && c != 0) {
-                                c = 0;
-                                continue;
+        for (const Token &token : tokens) {
+                std::string_view text = expression.substr(token.begin, token.length);
+
+                switch (token.kind) {
+                case eTokenInteger:
+                case eTokenReal:
+                        ps.push_literal(token.kind, text);
+                        break;
+                case eTokenIdentifier:
+                        // std::cout << "variable: " << text << std::endl;
+                        // TODO: literal constructor?
+                        ps.push({ ps.node <Variable> (symbol(text)), eVariable });
+
+                        // TODO: permit underscores for variable names
+                        // and later longer grouped underscores (e.g. y_{3,4})
+                        // will also need to remember if ay indices are present in the
+                        // underscores
+                        break;
+                case eTokenOperator:
+                        ps.push(lookup_operator(text[0]));
+                        break;
+                case eTokenOpen:
+                        ps.scopes.push(ps.operands.size());
+                        break;
+                case eTokenClose:
+                        if (ps.scopes.empty()) {
+                                ps.fail("unmatched \')\'");
+                                break;
                         }
 
-                        // If no state change or end of parsing, break
+                        ps.flush();
                         break;
                 }
 
-                if (ps.end())
-                        ps.flush();
+                if (!ps.error.empty())
+                        break;
         }
 
-        std::stack <Operand> stack = ps.operands;
-        Operand result = stack.top();
+        if (!ps.scopes.empty())
+                ps.fail("unmatched \'(\'");
+
+        if (ps.error.empty())
+                ps.flush();
 
-        // std::cout << "operands: " << stack.size() << std::endl;
-        // while (!stack.empty()) {
-        //         std::cout << "  > " << stack.top().string() << std::endl;
-        //         std::cout << stack.top().pretty() << std::endl;
-        //         stack.pop();
-        // }
+        // Everything must reduce to a single operand (e.g. not 2 3 or x y)
+        if (ps.operands.empty())
+                ps.fail("empty expression");
+        else if (ps.operands.size() > 1)
+                ps.fail("missing operator between operands");
+
+        if (!ps.error.empty()) {
+                error = ps.error;
+                scratch.clear();
+                return std::nullopt;
+        }
 
-        // TODO: perform some endof parsing checks
+        Operand result = ps.operands.top();
+        scratch.clear();
 
         return result;
 }
 
 }
+
+std::optional <Operand> parse(std::string_view expression)
+{
+        std::string error;
+        std::optional <Operand> opd = detail::parse(expression, nullptr, error);
+        if (!error.empty())
+                throw std::runtime_error(error);
+
+        return opd;
+}
+
+std::optional <Operand> parse(std::string_view expression, ExpressionArena &arena)
+{
+        std::string error;
+        std::optional <Operand> opd = detail::parse(expression, &arena, error);
+        if (!error.empty())
+                throw std::runtime_error(error);
+
+        return opd;
+}
+
+}
@@ -3,12 +3,23 @@
 // Standard headers
 #include <optional>
 #include <string>
+#include <string_view>
 
 // Local headers
 #include "operand.hpp"
 
 namespace fermat {
 
-std::optional <Operand> parse(const std::string &);
+std::optional <Operand> parse(std::string_view);
+
+// Parses without copying the input; all nodes are placed in the arena
+std::optional <Operand> parse(std::string_view, ExpressionArena &);
+
+namespace detail {
+
+// Non-throwing variant; on failure returns nullopt and sets the error message
+std::optional <Operand> parse(std::string_view, ExpressionArena *, std::string &);
+
+}
 
 }
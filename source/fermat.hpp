@@ -4,11 +4,24 @@
 
 // TODO: some of these are private API things...
 // TODO: use a detail namespace
+#include "arena.hpp"
+#include "corpus.hpp"
+#include "egraph.hpp"
 #include "error.hpp"
 #include "expr.hpp"
+#include "incremental.hpp"
 #include "jit.hpp"
+#include "lexer.hpp"
+#include "memo.hpp"
 #include "operand.hpp"
 #include "operation.hpp"
 #include "operation_impl.hpp"
 #include "partially_evaluated.hpp"
+#include "persistent_cache.hpp"
+#include "polynomial.hpp"
+#include "rational.hpp"
+#include "rewrite.hpp"
 #include "simplify.hpp"
+#include "symbol_table.hpp"
+#include "thread_pool.hpp"
+#include "unique_table.hpp"
@@ -0,0 +1,63 @@
+// Local headers
+#include "incremental.hpp"
+#include "simplify.hpp"
+
+namespace fermat {
+
+// NOTE: Only the subtree itself is marked; its own subtrees may be
+// dropped while it is in use, and are simplified again if edited later
+std::optional <Operand> IncrementalSimplifier::find(const Operand &source)
+{
+        auto it = subtrees.find(detail::fingerprint(source));
+        if (it == subtrees.end() || !detail::cmp(it->second.source, source))
+                return std::nullopt;
+
+        it->second.generation = generation;
+        stats.reused++;
+        return it->second.result;
+}
+
+// Replaces the subtree of the same fingerprint, if any
+void IncrementalSimplifier::insert(const Operand &source, const Operand &result)
+{
+        subtrees[detail::fingerprint(source)] = { source, result, generation };
+        stats.simplified++;
+}
+
+Operand IncrementalSimplifier::simplify(const Operand &opd)
+{
+        generation++;
+
+        detail::simplification_context sctx;
+        sctx.incremental = this;
+
+        Operand result = fermat::simplify(opd, sctx);
+
+        // Amortized over the calls which grew the table
+        if (subtrees.size() > 2 * watermark)
+                prune();
+
+        return result;
+}
+
+void IncrementalSimplifier::prune()
+{
+        for (auto it = subtrees.begin(); it != subtrees.end(); ) {
+                if (generation - it->second.generation >= lifetime) {
+                        it = subtrees.erase(it);
+                        stats.dropped++;
+                } else {
+                        it++;
+                }
+        }
+
+        watermark = subtrees.size();
+}
+
+void IncrementalSimplifier::clear()
+{
+        subtrees.clear();
+        watermark = 0;
+}
+
+}
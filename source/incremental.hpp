@@ -0,0 +1,57 @@
+#pragma once
+
+// Standard headers
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+// Local headers
+#include "operand.hpp"
+
+namespace fermat {
+
+// Simplifies successive versions of an expression (e.g. after small edits),
+// keeping the simplified form of each subtree between calls; unchanged
+// subtrees are reused, so only the path from an edit to the root is redone
+struct IncrementalSimplifier {
+        struct subtree {
+                Operand source;
+                Operand result;
+
+                // Last call in which the subtree was used
+                uint32_t generation = 0;
+        };
+
+        struct statistics {
+                size_t reused = 0;
+                size_t simplified = 0;
+                size_t dropped = 0;
+        };
+
+        // Canonical subtrees by fingerprint
+        std::unordered_map <uint64_t, subtree> subtrees;
+
+        // Number of calls after which unused subtrees are dropped
+        uint32_t lifetime;
+
+        uint32_t generation = 0;
+
+        statistics stats;
+
+        IncrementalSimplifier(uint32_t lifetime_ = 4) : lifetime { lifetime_ } {}
+
+        Operand simplify(const Operand &);
+
+        // Expressions are expected to be canonical (see detail::canonical)
+        std::optional <Operand> find(const Operand &);
+        void insert(const Operand &, const Operand &);
+
+        void clear();
+private:
+        // Size of the table after it was last pruned
+        size_t watermark = 0;
+
+        void prune();
+};
+
+}
@@ -1,6 +1,7 @@
 // Local headers
 #include "jit.hpp"
 #include "operation_impl.hpp"
+#include "simplify.hpp"
 
 namespace fermat {
 
@@ -42,27 +43,65 @@ gccjit::rvalue jit_parse(JITContext &jit_ctx, const BinaryGrouping &bg)
         return c;
 }
 
+// Sums and products are emitted as balanced reduction trees,
+// which keeps the dependency chains short
+gccjit::rvalue jit_parse(JITContext &jit_ctx, const NaryGrouping &ng)
+{
+        std::vector <gccjit::rvalue> current;
+        for (const Operand &opd : ng.opds)
+                current.push_back(jit_parse(jit_ctx, opd));
+
+        std::vector <gccjit::rvalue> next;
+        while (current.size() > 1) {
+                for (size_t i = 0; i + 1 < current.size(); i += 2) {
+                        if (ng.op->id == op_add->id)
+                                next.push_back(jit_ctx.ctx.new_plus(jit_ctx.type, current[i], current[i + 1]));
+                        else if (ng.op->id == op_mul->id)
+                                next.push_back(jit_ctx.ctx.new_mult(jit_ctx.type, current[i], current[i + 1]));
+                        else
+                                throw std::runtime_error("unsupported n-ary operator: " + ng.string());
+                }
+
+                if (current.size() % 2)
+                        next.push_back(current.back());
+
+                current = std::move(next);
+                next.clear();
+        }
+
+        return current[0];
+}
+
 gccjit::rvalue jit_parse(JITContext &jit_ctx, const Operand &opd)
 {
         if (opd.is_blank())
                 throw std::runtime_error("blank operand");
 
         if (opd.is_constant()) {
-                double d = (opd.type == eReal) ? opd.r : opd.i;
+                double d = detail::real(opd);
                 return jit_ctx.ctx.new_rvalue(jit_ctx.type, d);
         }
 
-        UnresolvedOperand uo = opd.uo;
-        if (uo.type == eVariable) {
-                auto it = jit_ctx.variables.find(uo.as_variable().lexicon);
+        // Subtrees without variables are folded before emitting them
+        if (detail::is_constant(opd)) {
+                Operand folded = simplify(opd, SimplifyOptions {});
+                if (folded.is_constant())
+                        return jit_parse(jit_ctx, folded);
+        }
+
+        if (opd.is_variable()) {
+                auto it = jit_ctx.variables.find(opd.as_variable().symbol);
                 if (it == jit_ctx.variables.end())
                         throw std::runtime_error("variable not found");
 
                 return it->second;
         }
 
-        if (uo.type == eBinaryGrouping)
-                return jit_parse(jit_ctx, uo.as_binary_grouping());
+        if (opd.is_binary_grouping())
+                return jit_parse(jit_ctx, opd.as_binary_grouping());
+
+        if (opd.is_nary_grouping())
+                return jit_parse(jit_ctx, opd.as_nary_grouping());
 
         throw std::runtime_error("unsupported operand type");
 }
@@ -1,8 +1,8 @@
 #pragma once
 
 // Standard headers
-#include <map>
 #include <string>
+#include <unordered_map>
 
 // JIT
 #include <libgccjit++.h>
@@ -22,7 +22,7 @@ struct JITContext {
 
         gccjit::block block;
 
-        std::map <std::string, gccjit::lvalue> variables;
+        std::unordered_map <SymbolId, gccjit::lvalue> variables;
 
         // TODO: local function table for currently imported function symbols
 };
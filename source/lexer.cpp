@@ -0,0 +1,259 @@
+// Standard headers
+#include <bit>
+#include <cstring>
+
+// SIMD headers
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Local headers
+#include "lexer.hpp"
+
+namespace fermat {
+
+namespace detail {
+
+// NOTE: Operators are hard coded for now, and must
+// agree with the operator table of the parser
+static CharacterMasks classify_scalar(const char *block)
+{
+        CharacterMasks masks;
+        for (int i = 0; i < 64; i++) {
+                unsigned char c = block[i];
+                unsigned char lower = c | 0x20;
+                uint64_t bit = 1ull << i;
+
+                if (c >= '0' && c <= '9')
+                        masks.digit |= bit;
+                else if (lower >= 'a' && lower <= 'z')
+                        masks.alpha |= bit;
+                else if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^')
+                        masks.op |= bit;
+                else if (c == '(' || c == ')')
+                        masks.paren |= bit;
+                else if (c == ' ' || (c >= '\t' && c <= '\r'))
+                        masks.space |= bit;
+        }
+
+        return masks;
+}
+
+#if defined(__AVX2__)
+
+// NOTE: Bytes above 0x7f compare as negative, so they fall in no class
+static CharacterMasks classify_vectorized(const char *block)
+{
+        CharacterMasks masks;
+        for (int i = 0; i < 64; i += 32) {
+                __m256i c = _mm256_loadu_si256(reinterpret_cast <const __m256i *> (block + i));
+                __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+
+                auto eq = [&](char x) {
+                        return _mm256_cmpeq_epi8(c, _mm256_set1_epi8(x));
+                };
+
+                auto in = [](__m256i v, char lo, char hi) {
+                        return _mm256_and_si256(
+                                _mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+                };
+
+                __m256i digit = in(c, '0', '9');
+                __m256i alpha = in(lower, 'a', 'z');
+                __m256i op = _mm256_or_si256(_mm256_or_si256(eq('+'), eq('-')),
+                        _mm256_or_si256(_mm256_or_si256(eq('*'), eq('/')), eq('^')));
+                __m256i paren = _mm256_or_si256(eq('('), eq(')'));
+                __m256i space = _mm256_or_si256(eq(' '), in(c, '\t', '\r'));
+
+                auto bits = [](__m256i v) -> uint64_t {
+                        return static_cast <uint32_t> (_mm256_movemask_epi8(v));
+                };
+
+                masks.digit |= bits(digit) << i;
+                masks.alpha |= bits(alpha) << i;
+                masks.op |= bits(op) << i;
+                masks.paren |= bits(paren) << i;
+                masks.space |= bits(space) << i;
+        }
+
+        return masks;
+}
+
+#elif defined(__SSE2__)
+
+// NOTE: Bytes above 0x7f compare as negative, so they fall in no class
+static CharacterMasks classify_vectorized(const char *block)
+{
+        CharacterMasks masks;
+        for (int i = 0; i < 64; i += 16) {
+                __m128i c = _mm_loadu_si128(reinterpret_cast <const __m128i *> (block + i));
+                __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+                auto eq = [&](char x) {
+                        return _mm_cmpeq_epi8(c, _mm_set1_epi8(x));
+                };
+
+                auto in = [](__m128i v, char lo, char hi) {
+                        return _mm_and_si128(
+                                _mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+                };
+
+                __m128i digit = in(c, '0', '9');
+                __m128i alpha = in(lower, 'a', 'z');
+                __m128i op = _mm_or_si128(_mm_or_si128(eq('+'), eq('-')),
+                        _mm_or_si128(_mm_or_si128(eq('*'), eq('/')), eq('^')));
+                __m128i paren = _mm_or_si128(eq('('), eq(')'));
+                __m128i space = _mm_or_si128(eq(' '), in(c, '\t', '\r'));
+
+                auto bits = [](__m128i v) -> uint64_t {
+                        return static_cast <uint16_t> (_mm_movemask_epi8(v));
+                };
+
+                masks.digit |= bits(digit) << i;
+                masks.alpha |= bits(alpha) << i;
+                masks.op |= bits(op) << i;
+                masks.paren |= bits(paren) << i;
+                masks.space |= bits(space) << i;
+        }
+
+        return masks;
+}
+
+#else
+
+static CharacterMasks classify_vectorized(const char *block)
+{
+        return classify_scalar(block);
+}
+
+#endif
+
+void classify(std::string_view text, std::vector <CharacterMasks> &masks, bool vectorized)
+{
+        auto classify_block = vectorized ? classify_vectorized : classify_scalar;
+
+        size_t full = text.size() / 64;
+        masks.resize((text.size() + 63) / 64);
+        for (size_t w = 0; w < full; w++)
+                masks[w] = classify_block(text.data() + 64 * w);
+
+        // Pad the tail with zeros, which belong to no class
+        if (full < masks.size()) {
+                char tail[64] = {};
+                std::memcpy(tail, text.data() + 64 * full, text.size() - 64 * full);
+                masks[full] = classify_block(tail);
+        }
+}
+
+using CharacterClass = uint64_t CharacterMasks::*;
+
+static bool test(const std::vector <CharacterMasks> &masks, CharacterClass cls, size_t i)
+{
+        return (masks[i >> 6].*cls >> (i & 63)) & 1;
+}
+
+// First index at or after i which is not in the class
+static size_t skip(const std::vector <CharacterMasks> &masks, CharacterClass cls, size_t i)
+{
+        size_t w = i >> 6;
+        if (w >= masks.size())
+                return i;
+
+        uint64_t bits = ~(masks[w].*cls) & (~0ull << (i & 63));
+        while (!bits) {
+                if (++w == masks.size())
+                        return 64 * w;
+
+                bits = ~(masks[w].*cls);
+        }
+
+        return 64 * w + std::countr_zero(bits);
+}
+
+bool tokenize(std::string_view text, std::vector <Token> &tokens, std::string &error, bool vectorized)
+{
+        // Reused across calls to avoid allocating
+        static thread_local std::vector <CharacterMasks> masks;
+        classify(text, masks, vectorized);
+
+        // Upper bound, so that the token list is allocated once
+        tokens.reserve(tokens.size() + text.size());
+
+        auto fail = [&](const std::string &msg) {
+                error = "parsing: " + msg;
+                return false;
+        };
+
+        auto emit = [&](TokenKind kind, size_t begin, size_t end) {
+                tokens.push_back({ kind, static_cast <uint32_t> (begin), static_cast <uint32_t> (end - begin) });
+        };
+
+        size_t n = text.size();
+        size_t i = 0;
+        while (i < n) {
+                if (test(masks, &CharacterMasks::space, i)) {
+                        i = std::min(skip(masks, &CharacterMasks::space, i), n);
+                        continue;
+                }
+
+                size_t begin = i;
+                char c = text[i];
+
+                if (test(masks, &CharacterMasks::digit, i) || c == '.') {
+                        TokenKind kind = eTokenInteger;
+
+                        i = std::min(skip(masks, &CharacterMasks::digit, i), n);
+                        if (i < n && text[i] == '.') {
+                                kind = eTokenReal;
+                                i = std::min(skip(masks, &CharacterMasks::digit, i + 1), n);
+                        }
+
+                        // Only an exponent if digits follow, otherwise
+                        // the e is left for the next token
+                        if (i < n && (text[i] == 'e' || text[i] == 'E')) {
+                                size_t exp = i + 1;
+                                if (exp < n && (text[exp] == '+' || text[exp] == '-'))
+                                        exp++;
+
+                                if (exp < n && test(masks, &CharacterMasks::digit, exp)) {
+                                        kind = eTokenReal;
+                                        i = std::min(skip(masks, &CharacterMasks::digit, exp), n);
+                                }
+                        }
+
+                        if (i == begin + 1 && c == '.')
+                                return fail("unexpected \'.\'");
+
+                        if (i < n && text[i] == '.')
+                                return fail("unexpected \'.\' in real number");
+
+                        emit(kind, begin, i);
+                } else if (test(masks, &CharacterMasks::alpha, i)) {
+                        // Letters followed by letters or digits, e.g. x or theta2
+                        // TODO: subscripts (e.g. x_1)
+                        while (i < n && (test(masks, &CharacterMasks::alpha, i) || test(masks, &CharacterMasks::digit, i))) {
+                                i = std::max(skip(masks, &CharacterMasks::alpha, i),
+                                        skip(masks, &CharacterMasks::digit, i));
+                        }
+
+                        emit(eTokenIdentifier, begin, std::min(i, n));
+                } else if (test(masks, &CharacterMasks::op, i)) {
+                        // TODO: mutlicharacter operators?
+                        emit(eTokenOperator, begin, ++i);
+                } else if (test(masks, &CharacterMasks::paren, i)) {
+                        emit(c == '(' ? eTokenOpen : eTokenClose, begin, ++i);
+                } else {
+                        return fail("unexpected character: \'" + std::string(1, c) + "\'");
+                }
+        }
+
+        return true;
+}
+
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Standard headers
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fermat {
+
+enum TokenKind : uint8_t {
+        eTokenInteger,
+        eTokenReal,
+        eTokenIdentifier,
+        eTokenOperator,
+        eTokenOpen,
+        eTokenClose,
+};
+
+struct Token {
+        TokenKind kind;
+        uint32_t begin;
+        uint32_t length;
+};
+
+namespace detail {
+
+// Character classes of 64 bytes of input, one bit per byte
+struct CharacterMasks {
+        uint64_t digit = 0;
+        uint64_t alpha = 0;
+        uint64_t op = 0;
+        uint64_t paren = 0;
+        uint64_t space = 0;
+};
+
+// Classifies 16 or 32 bytes at a time with SSE2 or AVX2 when available,
+// otherwise (or if not vectorized) one byte at a time
+// NOTE: Bits past the end of the input are always clear
+void classify(std::string_view, std::vector <CharacterMasks> &, bool vectorized = true);
+
+// Splits the input into tokens; returns false and sets the error message on
+// the first character which cannot start a token
+bool tokenize(std::string_view, std::vector <Token> &, std::string &, bool vectorized = true);
+
+}
+
+}
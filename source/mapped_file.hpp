@@ -0,0 +1,60 @@
+#pragma once
+
+// Standard headers
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fermat {
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+        const char *data = nullptr;
+        size_t size = 0;
+
+        MappedFile(const std::string &path) {
+                int fd = open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                        throw std::runtime_error("MappedFile: failed to open " + path);
+
+                struct stat st;
+                if (fstat(fd, &st) < 0) {
+                        close(fd);
+                        throw std::runtime_error("MappedFile: failed to stat " + path);
+                }
+
+                size = st.st_size;
+                if (size > 0) {
+                        void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                        if (ptr == MAP_FAILED) {
+                                close(fd);
+                                throw std::runtime_error("MappedFile: failed to map " + path);
+                        }
+
+                        data = static_cast <const char *> (ptr);
+                }
+
+                // The mapping stays valid after closing
+                close(fd);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile() {
+                if (data)
+                        munmap(const_cast <char *> (data), size);
+        }
+
+        std::string_view view() const {
+                return { data, size };
+        }
+};
+
+}
@@ -0,0 +1,157 @@
+// Standard headers
+#include <span>
+
+// Local headers
+#include "memo.hpp"
+#include "simplify.hpp"
+
+namespace fermat {
+
+// Nodes which are shared with other expressions are counted for each entry
+static size_t footprint(const Operand &source, const Operand &result)
+{
+        size_t nodes = detail::size(source) + detail::size(result);
+        return sizeof(SimplificationMemo::entry) + nodes * sizeof(BinaryGrouping);
+}
+
+std::optional <Operand> SimplificationMemo::find(const Operand &source)
+{
+        uint64_t fingerprint = detail::fingerprint(source);
+        shard &shard = table[fingerprint % shards];
+
+        {
+                std::lock_guard <std::mutex> lock(shard.mutex);
+
+                auto it = shard.index.find(fingerprint);
+                if (it != shard.index.end()) {
+                        entry &e = shard.entries[it->second];
+                        if (detail::cmp(e.source, source)) {
+                                e.referenced = true;
+                                hits.fetch_add(1, std::memory_order_relaxed);
+                                return e.result;
+                        }
+                }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+}
+
+void SimplificationMemo::insert(const Operand &source, const Operand &result)
+{
+        size_t bytes = footprint(source, result);
+        size_t limit = budget / shards;
+        if (bytes > limit)
+                return;
+
+        uint64_t fingerprint = detail::fingerprint(source);
+        shard &shard = table[fingerprint % shards];
+
+        // NOTE: Declared before the lock, so that evicted
+        // expressions are released after it is unlocked
+        std::vector <Operand> released;
+
+        std::lock_guard <std::mutex> lock(shard.mutex);
+
+        // Replaces the entry of the same fingerprint, if any
+        auto it = shard.index.find(fingerprint);
+        if (it != shard.index.end()) {
+                entry &e = shard.entries[it->second];
+                shard.bytes -= e.bytes;
+                shard.free.push_back(it->second);
+                shard.index.erase(it);
+
+                released.push_back(std::move(e.source));
+                released.push_back(std::move(e.result));
+                e = {};
+        }
+
+        // Second chance for entries which were referenced since the
+        // hand last passed them, otherwise evict them
+        while (shard.bytes + bytes > limit && shard.bytes > 0) {
+                size_t i = shard.hand;
+                shard.hand = (shard.hand + 1) % shard.entries.size();
+
+                entry &e = shard.entries[i];
+                if (e.source.is_blank())
+                        continue;
+
+                if (e.referenced) {
+                        e.referenced = false;
+                        continue;
+                }
+
+                shard.index.erase(detail::fingerprint(e.source));
+                shard.bytes -= e.bytes;
+                shard.free.push_back(i);
+
+                released.push_back(std::move(e.source));
+                released.push_back(std::move(e.result));
+                e = {};
+
+                evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint32_t slot;
+        if (shard.free.empty()) {
+                slot = shard.entries.size();
+                shard.entries.emplace_back();
+        } else {
+                slot = shard.free.back();
+                shard.free.pop_back();
+        }
+
+        shard.entries[slot] = { source, result, bytes, false };
+        shard.index[fingerprint] = slot;
+        shard.bytes += bytes;
+
+        insertions.fetch_add(1, std::memory_order_relaxed);
+}
+
+SimplificationMemo::statistics SimplificationMemo::stats()
+{
+        statistics stats {
+                .hits = hits.load(std::memory_order_relaxed),
+                .misses = misses.load(std::memory_order_relaxed),
+                .insertions = insertions.load(std::memory_order_relaxed),
+                .evictions = evictions.load(std::memory_order_relaxed),
+        };
+
+        for (shard &shard : std::span(table.get(), shards)) {
+                std::lock_guard <std::mutex> lock(shard.mutex);
+                stats.entries += shard.index.size();
+                stats.bytes += shard.bytes;
+        }
+
+        return stats;
+}
+
+std::vector <std::pair <Operand, Operand>> SimplificationMemo::snapshot()
+{
+        std::vector <std::pair <Operand, Operand>> pairs;
+        for (shard &shard : std::span(table.get(), shards)) {
+                std::lock_guard <std::mutex> lock(shard.mutex);
+                for (const entry &e : shard.entries) {
+                        if (!e.source.is_blank())
+                                pairs.push_back({ e.source, e.result });
+                }
+        }
+
+        return pairs;
+}
+
+void SimplificationMemo::clear()
+{
+        for (shard &shard : std::span(table.get(), shards)) {
+                std::vector <entry> released;
+
+                std::lock_guard <std::mutex> lock(shard.mutex);
+                released.swap(shard.entries);
+                shard.free.clear();
+                shard.index.clear();
+                shard.hand = 0;
+                shard.bytes = 0;
+        }
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// Standard headers
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Local headers
+#include "operand.hpp"
+
+namespace fermat {
+
+// Simplified forms of canonical expressions, shared between calls to
+// simplify (and between threads); bounded by a memory budget, beyond
+// which entries are evicted in CLOCK order
+// NOTE: The memo keeps its entries alive, so it must not outlive
+// the arenas of any expressions simplified with it
+struct SimplificationMemo {
+        struct entry {
+                Operand source;
+                Operand result;
+                size_t bytes = 0;
+                bool referenced = false;
+        };
+
+        // Slots of evicted entries are reused
+        struct shard {
+                std::mutex mutex;
+                std::vector <entry> entries;
+                std::vector <uint32_t> free;
+                std::unordered_map <uint64_t, uint32_t> index;
+                size_t hand = 0;
+                size_t bytes = 0;
+        };
+
+        struct statistics {
+                size_t hits = 0;
+                size_t misses = 0;
+                size_t insertions = 0;
+                size_t evictions = 0;
+                size_t entries = 0;
+                size_t bytes = 0;
+
+                double hit_rate() const {
+                        size_t lookups = hits + misses;
+                        return lookups ? double(hits) / lookups : 0.0;
+                }
+        };
+
+        // Approximate, in bytes of nodes; split evenly between the shards
+        size_t budget;
+
+        // Shards reduce contention when shared between threads
+        size_t shards;
+
+        std::unique_ptr <shard []> table;
+
+        std::atomic <size_t> hits = 0;
+        std::atomic <size_t> misses = 0;
+        std::atomic <size_t> insertions = 0;
+        std::atomic <size_t> evictions = 0;
+
+        SimplificationMemo(size_t budget_ = 64 << 20, size_t shards_ = 16)
+                : budget { budget_ }, shards { shards_ },
+                table { new shard [shards_] } {}
+
+        SimplificationMemo(const SimplificationMemo &) = delete;
+        SimplificationMemo &operator=(const SimplificationMemo &) = delete;
+
+        // Expressions are expected to be canonical (see detail::canonical)
+        std::optional <Operand> find(const Operand &);
+        void insert(const Operand &, const Operand &);
+
+        statistics stats();
+
+        // Pairs of source expressions and their simplified forms
+        std::vector <std::pair <Operand, Operand>> snapshot();
+
+        void clear();
+};
+
+}
@@ -1,8 +1,31 @@
+// Standard headers
+#include <algorithm>
+
+// Local headers
+#include "error.hpp"
 #include "operand.hpp"
+#include "operation_impl.hpp"
+#include "unique_table.hpp"
 
 namespace fermat {
 
-// Deep clone
+Operand::Operand(const Rational &q)
+{
+        std::optional <int64_t> n = q.numerator.integer();
+        if (q.is_integer() && n) {
+                i = *n;
+                type = eInteger;
+                return;
+        }
+
+        Uptr uptr = detail::intern(detail::global_table(), BoxedRational { q });
+        node = uptr.get();
+        type = eRational;
+        boxed = true;
+        retain(node);
+}
+
+// Deep clone, into private nodes
 Operand Operand::clone() const
 {
         // Only need to clone when operand stores a pointer
@@ -10,23 +33,40 @@ Operand Operand::clone() const
         if (is_blank() || is_constant())
                 return *this;
 
-        if (uo.type == eVariable) {
+        if (kind() == eVariable) {
                 return Operand {
-                        new_ <Variable> (uo.as_variable()),
+                        private_new <Variable> (as_variable()),
                         eVariable
                 };
         }
 
-        if (uo.type == eBinaryGrouping) {
+        if (kind() == eBinaryGrouping) {
                 return Operand {
-                        new_ <BinaryGrouping> (uo.as_binary_grouping().clone()),
+                        private_new <BinaryGrouping> (as_binary_grouping().clone()),
                         eBinaryGrouping
                 };
         }
 
+        if (kind() == eNaryGrouping) {
+                return Operand {
+                        private_new <NaryGrouping> (as_nary_grouping().clone()),
+                        eNaryGrouping
+                };
+        }
+
         throw std::runtime_error("Operand::clone(): unknown type");
 }
 
+bool Operand::is_sum() const
+{
+        return is_nary_grouping() && as_nary_grouping().op->id == op_add->id;
+}
+
+bool Operand::is_product() const
+{
+        return is_nary_grouping() && as_nary_grouping().op->id == op_mul->id;
+}
+
 // Printing
 std::string Operand::string(Operation *parent) const
 {
@@ -34,15 +74,26 @@ std::string Operand::string(Operation *parent) const
                 return std::to_string(i);
         
         if (type == eReal)
-                return std::to_string(r);
+                return std::to_string(r());
+
+        // Parenthesized like a quotient
+        if (type == eRational) {
+                if (parent && !q().is_integer() && ePriorityMultiplicative < parent->priority)
+                        return "(" + q().string() + ")";
+
+                return q().string();
+        }
 
         if (type == eUnresolved) {
                 // TODO: show the indices..
-                if (uo.type == eVariable)
-                        return static_cast <Variable *> (uo.ptr.get())->string(parent);
+                if (kind() == eVariable)
+                        return as_variable().string(parent);
+
+                if (kind() == eBinaryGrouping)
+                        return as_binary_grouping().string(parent);
 
-                if (uo.type == eBinaryGrouping)
-                        return static_cast <BinaryGrouping *> (uo.ptr.get())->string(parent);
+                if (kind() == eNaryGrouping)
+                        return as_nary_grouping().string(parent);
         }
 
         return "<?:" + std::to_string(type) + ">";
@@ -56,18 +107,353 @@ std::string Operand::pretty(int indent) const
                 return inter + "<integer:" + std::to_string(i) + ">";
         
         if (type == eReal)
-                return inter + "<real:" + std::to_string(r) + ">";
+                return inter + "<real:" + std::to_string(r()) + ">";
+
+        if (type == eRational)
+                return inter + "<rational:" + q().string() + ">";
 
         if (type == eUnresolved) {
                 // TODO: show the indices..
-                if (uo.type == eVariable)
-                        return static_cast <Variable *> (uo.ptr.get())->pretty(indent);
+                if (kind() == eVariable)
+                        return as_variable().pretty(indent);
+
+                if (kind() == eBinaryGrouping)
+                        return as_binary_grouping().pretty(indent);
 
-                if (uo.type == eBinaryGrouping)
-                        return static_cast <BinaryGrouping *> (uo.ptr.get())->pretty(indent);
+                if (kind() == eNaryGrouping)
+                        return as_nary_grouping().pretty(indent);
         }
 
         return inter + "<?:" + std::to_string(type) + ">";
 }
 
+namespace detail {
+
+template <typename T>
+static void destroy_as(Node *node)
+{
+        std::pmr::memory_resource *resource = node->resource;
+
+        T *ptr = static_cast <T *> (node);
+        ptr->~T();
+
+        node_resource(resource)->deallocate(ptr, sizeof(T), alignof(T));
+}
+
+void destroy(const Node *cnode)
+{
+        Node *node = const_cast <Node *> (cnode);
+
+        // Has to be removed before its children are released
+        if (node->table)
+                node->table->forget(node);
+
+        switch (node->kind) {
+        case eReal:
+                return destroy_as <BoxedReal> (node);
+        case eRational:
+                return destroy_as <BoxedRational> (node);
+        case eVariable:
+                return destroy_as <Variable> (node);
+        case eBinaryGrouping:
+                return destroy_as <BinaryGrouping> (node);
+        case eNaryGrouping:
+                return destroy_as <NaryGrouping> (node);
+        default:
+                break;
+        }
+
+        fatal_error("destroy", "unknown node kind " + std::to_string(node->kind));
+}
+
+// NOTE: Hashed by name rather than symbol id, so that
+// fingerprints are the same across processes
+uint64_t fingerprint(const Variable &var)
+{
+        return mix(eVariable, digest(var.lexicon()));
+}
+
+uint64_t fingerprint(const BinaryGrouping &bg)
+{
+        uint64_t seed = mix(eBinaryGrouping, bg.op ? bg.op->id : -1);
+        seed = mix(seed, fingerprint(bg.opda));
+        return mix(seed, fingerprint(bg.opdb));
+}
+
+uint64_t fingerprint(const NaryGrouping &ng)
+{
+        uint64_t seed = mix(eNaryGrouping, ng.op->id);
+        for (const Operand &opd : ng.opds)
+                seed = mix(seed, fingerprint(opd));
+
+        return seed;
+}
+
+// Long doubles are split into two doubles, which
+// avoids hashing the padding of the representation
+static uint64_t fingerprint(const BoxedReal &br)
+{
+        double high = br.value;
+        double low = br.value - high;
+        return mix(mix(eReal, std::bit_cast <uint64_t> (high)), std::bit_cast <uint64_t> (low));
+}
+
+uint64_t fingerprint(const Rational &q)
+{
+        uint64_t seed = mix(eRational, q.numerator.negative);
+        for (uint32_t limb : q.numerator.limbs)
+                seed = mix(seed, limb);
+
+        for (uint32_t limb : q.denominator.limbs)
+                seed = mix(seed, limb);
+
+        return mix(seed, q.denominator.limbs.size());
+}
+
+void seal(Node *node)
+{
+        switch (node->kind) {
+        case eReal:
+        {
+                BoxedReal *br = static_cast <BoxedReal *> (node);
+                node->fingerprint = fingerprint(*br);
+                node->size = 1;
+                node->complexity = br->value > 0 ? 1 : 2;
+                return;
+        }
+        case eRational:
+        {
+                BoxedRational *bq = static_cast <BoxedRational *> (node);
+                node->fingerprint = fingerprint(bq->value);
+                node->size = 1;
+                node->complexity = bq->value.is_negative() ? 2 : 1;
+                return;
+        }
+        case eVariable:
+        {
+                Variable *var = static_cast <Variable *> (node);
+                node->fingerprint = fingerprint(*var);
+                node->size = 1;
+                node->variables = uint64_t(1) << (var->symbol % 64);
+                node->complexity = var->lexicon().size();
+                node->polynomial = true;
+                return;
+        }
+        case eBinaryGrouping:
+        {
+                BinaryGrouping *bg = static_cast <BinaryGrouping *> (node);
+                node->fingerprint = fingerprint(*bg);
+                node->size = 1 + size(bg->opda) + size(bg->opdb);
+                node->depth = 1 + std::max(depth(bg->opda), depth(bg->opdb));
+                node->variables = variables(bg->opda) | variables(bg->opdb);
+                node->complexity = complexity(bg->opda) + complexity(bg->opdb);
+                node->canonical = !bg->degenerate() && !flattens(bg->op)
+                        && is_canonical(bg->opda) && is_canonical(bg->opdb);
+
+                if (bg->degenerate())
+                        node->polynomial = is_polynomial(bg->opda);
+                else if (bg->op->id == op_exp->id)
+                        node->polynomial = is_polynomial(bg->opda) && bg->opdb.is_integer() && bg->opdb.i >= 0;
+                else if (bg->op->id == op_add->id || bg->op->id == op_sub->id || bg->op->id == op_mul->id)
+                        node->polynomial = is_polynomial(bg->opda) && is_polynomial(bg->opdb);
+
+                return;
+        }
+        case eNaryGrouping:
+        {
+                NaryGrouping *ng = static_cast <NaryGrouping *> (node);
+                node->fingerprint = fingerprint(*ng);
+                node->size = 1;
+                node->depth = 1;
+                node->variables = 0;
+                node->complexity = 0;
+                node->canonical = flattens(ng->op) && ng->opds.size() > 1;
+                node->polynomial = (ng->op->id == op_add->id || ng->op->id == op_mul->id);
+                for (size_t i = 0; i < ng->opds.size(); i++) {
+                        const Operand &opd = ng->opds[i];
+                        node->size += size(opd);
+                        node->depth = std::max(node->depth, 1 + depth(opd));
+                        node->variables |= variables(opd);
+                        node->complexity += complexity(opd);
+                        node->polynomial = node->polynomial && is_polynomial(opd);
+
+                        // Operands must be canonical, sorted and not nested
+                        if (!node->canonical)
+                                continue;
+
+                        if (!is_canonical(opd) || (i > 0 && order(ng->opds[i - 1], opd) > 0))
+                                node->canonical = false;
+                        else if (opd.is_nary_grouping() && opd.as_nary_grouping().op->id == ng->op->id)
+                                node->canonical = false;
+                }
+
+                return;
+        }
+        default:
+                break;
+        }
+
+        fatal_error("seal", "unknown node kind " + std::to_string(node->kind));
+}
+
+static int rank(const Operand &opd)
+{
+        if (opd.is_constant())
+                return 0;
+
+        if (opd.is_blank())
+                return -1;
+
+        switch (opd.kind()) {
+        case eVariable:
+                return 1;
+        case eBinaryGrouping:
+                return 2;
+        case eNaryGrouping:
+                return 3;
+        }
+
+        return 4;
+}
+
+template <typename T>
+static int three_way(const T &a, const T &b)
+{
+        return (a < b) ? -1 : (b < a);
+}
+
+static int order_id(const Operation *a, const Operation *b)
+{
+        return three_way <OperationId> (a ? a->id : -1, b ? b->id : -1);
+}
+
+int order(const Operand &a, const Operand &b)
+{
+        if (int c = three_way(rank(a), rank(b)))
+                return c;
+
+        if (a.is_constant()) {
+                if (a.is_integer() && b.is_integer())
+                        return three_way(a.i, b.i);
+
+                // Exactly, unless either is a real
+                int c = 0;
+                if (a.is_rational() && b.is_rational())
+                        c = compare(a.q(), b.q());
+                else if (!a.is_real() && !b.is_real())
+                        c = compare(rational(a), rational(b));
+                else
+                        c = three_way(real(a), real(b));
+
+                if (c)
+                        return c;
+
+                // Integers before reals of the same value
+                return three_way(a.type, b.type);
+        }
+
+        // Interned nodes are unique
+        if (a.is_blank() || a.node == b.node)
+                return 0;
+
+        if (a.is_variable())
+                return three_way(a.as_variable().symbol, b.as_variable().symbol);
+
+        if (a.is_binary_grouping()) {
+                const BinaryGrouping &bga = a.as_binary_grouping();
+                const BinaryGrouping &bgb = b.as_binary_grouping();
+
+                if (int c = order_id(bga.op, bgb.op))
+                        return c;
+
+                if (int c = order(bga.opda, bgb.opda))
+                        return c;
+
+                return order(bga.opdb, bgb.opdb);
+        }
+
+        if (a.is_nary_grouping()) {
+                const NaryGrouping &nga = a.as_nary_grouping();
+                const NaryGrouping &ngb = b.as_nary_grouping();
+
+                if (int c = order_id(nga.op, ngb.op))
+                        return c;
+
+                size_t size = std::min(nga.opds.size(), ngb.opds.size());
+                for (size_t i = 0; i < size; i++) {
+                        if (int c = order(nga.opds[i], ngb.opds[i]))
+                                return c;
+                }
+
+                return three_way(nga.opds.size(), ngb.opds.size());
+        }
+
+        return 0;
+}
+
+void canonicalize(Operation *op, std::vector <Operand> &opds)
+{
+        // NOTE: Nested groupings are already flat
+        for (size_t i = 0; i < opds.size(); i++) {
+                if (!opds[i].is_nary_grouping())
+                        continue;
+
+                const NaryGrouping &ng = opds[i].as_nary_grouping();
+                if (ng.op->id != op->id)
+                        continue;
+
+                Operand nested = std::move(opds[i]);
+                opds[i] = ng.opds[0];
+                opds.insert(opds.end(), ng.opds.begin() + 1, ng.opds.end());
+        }
+
+        // NOTE: Operands which are ordered equally are identical
+        std::sort(opds.begin(), opds.end(),
+                [](const Operand &a, const Operand &b) {
+                        return order(a, b) < 0;
+                }
+        );
+}
+
+// NOTE: Bottom up, so that each grouping is sorted once
+Operand canonical(const Operand &opd)
+{
+        if (is_canonical(opd))
+                return opd;
+
+        if (opd.is_binary_grouping()) {
+                const BinaryGrouping &bg = opd.as_binary_grouping();
+                if (bg.degenerate())
+                        return canonical(bg.opda);
+
+                Operand opda = canonical(bg.opda);
+                Operand opdb = canonical(bg.opdb);
+                if (!flattens(bg.op))
+                        return { new_ <BinaryGrouping> (bg.op, std::move(opda), std::move(opdb)), eBinaryGrouping };
+
+                std::vector <Operand> opds { std::move(opda), std::move(opdb) };
+                canonicalize(bg.op, opds);
+                return { new_ <NaryGrouping> (bg.op, opds), eNaryGrouping };
+        }
+
+        if (opd.is_nary_grouping()) {
+                const NaryGrouping &ng = opd.as_nary_grouping();
+
+                std::vector <Operand> opds;
+                opds.reserve(ng.opds.size());
+                for (const Operand &item : ng.opds)
+                        opds.push_back(canonical(item));
+
+                canonicalize(ng.op, opds);
+                if (opds.size() == 1)
+                        return opds[0];
+
+                return { new_ <NaryGrouping> (ng.op, opds), eNaryGrouping };
+        }
+
+        return opd;
+}
+
+}
+
 }
@@ -1,13 +1,22 @@
 #pragma once
 
 // Standard headers
+#include <atomic>
+#include <bit>
 #include <cassert>
-#include <memory>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <span>
 #include <string>
+#include <utility>
 #include <vector>
 
 // Local headers
+#include "arena.hpp"
 #include "operation.hpp"
+#include "rational.hpp"
+#include "symbol_table.hpp"
 
 namespace fermat {
 
@@ -19,50 +28,170 @@ enum : int64_t {
 
         eInteger,
         eReal,
+        eRational,
         eUnresolved,
 
         eVariable,
         eFunction,
-        eBinaryGrouping
+        eBinaryGrouping,
+        eNaryGrouping
 };
 
 struct Variable;
 struct Function;
 struct BinaryGrouping;
+struct NaryGrouping;
+struct UniqueTable;
 
-using Uptr = std::shared_ptr <void>;
+// Common header of all nodes; nodes are reference counted intrusively
+// and destroyed (and removed from their table) with their last reference
+struct Node {
+        mutable std::atomic <uint32_t> references = 0;
+        int32_t kind;
 
-struct UnresolvedOperand {
-        Uptr ptr;
-        int64_t type;
-        
-        Variable &as_variable() {
-                assert(type == eVariable);
-                return *static_cast <Variable *> (ptr.get());
-        }
+        // Structural fingerprint and number of nodes and leaves in the
+        // subtree; computed once the node is created (see detail::seal)
+        uint64_t fingerprint = 0;
+        uint32_t size = 1;
 
-        BinaryGrouping &as_binary_grouping() {
-                assert(type == eBinaryGrouping);
-                return *static_cast <BinaryGrouping *> (ptr.get());
-        }
+        // Length of the longest path to a leaf, counting the node itself
+        uint32_t depth = 1;
 
-        const Variable &as_variable() const {
-                assert(type == eVariable);
-                return *static_cast <Variable *> (ptr.get());
-        }
+        // Variables of the subtree, as a mask of their symbols modulo 64;
+        // subtrees without any are constant (see detail::is_constant)
+        uint64_t variables = 0;
 
-        const BinaryGrouping &as_binary_grouping() const {
-                assert(type == eBinaryGrouping);
-                return *static_cast <BinaryGrouping *> (ptr.get());
+        // Perceptual complexity of the subtree (see detail::complexity)
+        int64_t complexity = 1;
+
+        // Whether the subtree is in canonical form (see detail::canonical)
+        bool canonical = true;
+
+        // Whether the subtree is a polynomial with integer coefficients,
+        // i.e. only has +, -, * and non-negative integer ^ (see Polynomial)
+        bool polynomial = false;
+
+        // Table which the node was interned in, if any; structurally
+        // identical nodes of the same table are the same node
+        UniqueTable *table = nullptr;
+
+        // Where the node was allocated, or the heap if null
+        std::pmr::memory_resource *resource = nullptr;
+
+        Node(int32_t kind_) : kind { kind_ } {}
+
+        // NOTE: Copies are never interned themselves
+        Node(const Node &other) : kind { other.kind } {}
+
+        Node &operator=(const Node &) {
+                return *this;
         }
 };
 
+// Real constants which do not fit inline in an operand
+struct BoxedReal : Node {
+        Real value;
+
+        BoxedReal(Real value_) : Node { eReal }, value { value_ } {}
+};
+
+// Exact constants which are not machine integers; these are interned,
+// so that they are keyed by address like other shared nodes
+struct BoxedRational : Node {
+        Rational value;
+
+        BoxedRational(Rational value_) : Node { eRational }, value { std::move(value_) } {}
+};
+
+namespace detail {
+
+void destroy(const Node *);
+
+// Computes the fingerprint, size and other metadata of a node from
+// its contents, which must not change afterwards; private nodes which
+// are modified in place (see Operand::clone) keep the metadata of
+// their original contents until they are canonicalized
+void seal(Node *);
+
+// Resource which nodes are allocated from by default
+inline std::pmr::memory_resource *node_resource(std::pmr::memory_resource *resource)
+{
+        return resource ? resource : std::pmr::new_delete_resource();
+}
+
+// Allocates a node from the resource, or the heap if null; nodes
+// which hold containers allocate them from the same resource
 template <typename T, typename ... Args>
-Uptr new_(Args ... args)
+T *allocate_node(std::pmr::memory_resource *resource, Args && ... args)
 {
-        return std::make_shared <T> (args ...);
+        std::pmr::polymorphic_allocator <> allocator(node_resource(resource));
+
+        T *node = allocator.new_object <T> (std::forward <Args> (args) ...);
+        node->resource = resource;
+        seal(node);
+        return node;
+}
+
+// Constructs a temporary node value, with the same resource
+template <typename T, typename ... Args>
+T make_node(std::pmr::memory_resource *resource, Args && ... args)
+{
+        std::pmr::polymorphic_allocator <> allocator(node_resource(resource));
+        return std::make_obj_using_allocator <T> (allocator, std::forward <Args> (args) ...);
+}
+
+}
+
+inline void retain(const Node *node)
+{
+        node->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void release(const Node *node)
+{
+        if (node->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                detail::destroy(node);
 }
 
+// Owning reference to a node
+struct NodePtr {
+        Node *ptr = nullptr;
+
+        NodePtr() = default;
+
+        explicit NodePtr(Node *ptr_) : ptr { ptr_ } {
+                if (ptr)
+                        retain(ptr);
+        }
+
+        NodePtr(const NodePtr &other) : NodePtr { other.ptr } {}
+
+        NodePtr(NodePtr &&other) : ptr { std::exchange(other.ptr, nullptr) } {}
+
+        NodePtr &operator=(NodePtr other) {
+                std::swap(ptr, other.ptr);
+                return *this;
+        }
+
+        ~NodePtr() {
+                if (ptr)
+                        release(ptr);
+        }
+
+        // Takes over a reference which is already held
+        static NodePtr adopt(Node *ptr) {
+                NodePtr np;
+                np.ptr = ptr;
+                return np;
+        }
+
+        Node *get() const {
+                return ptr;
+        }
+};
+
+using Uptr = NodePtr;
+
 // Operands are:
 //   integers
 //   real numbers
@@ -71,6 +200,9 @@ Uptr new_(Args ... args)
 //   factors
 //   terms
 //   expressions (parenthesized)
+//
+// Operands are 16 bytes: integers and reals which are exact as doubles are
+// stored inline, everything else is a reference to a node
 struct Operand {
         Operand() = default;
 
@@ -81,25 +213,63 @@ struct Operand {
 
         template <typename R>
         requires std::is_floating_point_v <R>
-        Operand(R r_) : r { r_ }, type { eReal } {}
+        Operand(R r_) : type { eReal } {
+                Real r = r_;
+                if (static_cast <Real> (static_cast <double> (r)) == r || r != r) {
+                        d = static_cast <double> (r);
+                } else {
+                        node = detail::allocate_node <BoxedReal> (nullptr, r);
+                        retain(node);
+                        boxed = true;
+                }
+        }
+
+        // Integers which fit are stored as such
+        Operand(const Rational &);
 
         // Assume unresolved
         Operand(const Uptr &uptr, int64_t type_)
-                : uo { .ptr = uptr, .type = type_ },
-                type { eUnresolved } {}
+                        : node { uptr.get() }, type { eUnresolved } {
+                assert(node && node->kind == type_);
+                retain(node);
+        }
 
-        // Deep clone
+        Operand(const Operand &other)
+                        : i { other.i }, type { other.type }, boxed { other.boxed } {
+                if (owns())
+                        retain(node);
+        }
+
+        Operand(Operand &&other)
+                        : i { other.i }, type { other.type }, boxed { other.boxed } {
+                other.type = eBlank;
+                other.boxed = false;
+        }
+
+        Operand &operator=(Operand other) {
+                std::swap(i, other.i);
+                std::swap(type, other.type);
+                std::swap(boxed, other.boxed);
+                return *this;
+        }
+
+        ~Operand() {
+                if (owns())
+                        release(node);
+        }
+
+        // Deep clone, into private nodes which can be modified in place
         Operand clone() const;
 
         // Properties
         bool is_zero() const {
                 return (type == eInteger && i == 0ll)
-                        || (type == eReal && r == 0.0l);
+                        || (type == eReal && r() == 0.0l);
         }
 
         bool is_one() const {
                 return (type == eInteger && i == 1ll)
-                        || (type == eReal && r == 1.0l);
+                        || (type == eReal && r() == 1.0l);
         }
 
         bool is_integer() const {
@@ -110,22 +280,86 @@ struct Operand {
                 return (type == eReal);
         }
 
+        bool is_rational() const {
+                return (type == eRational);
+        }
+
         bool is_constant() const {
-                return (type == eInteger || type == eReal);
+                return (type == eInteger || type == eReal || type == eRational);
         }
 
         bool is_variable() const {
-                return (type == eUnresolved) && (uo.type == eVariable);
+                return (type == eUnresolved) && (node->kind == eVariable);
         }
 
         bool is_binary_grouping() const {
-                return (type == eUnresolved) && (uo.type == eBinaryGrouping);
+                return (type == eUnresolved) && (node->kind == eBinaryGrouping);
         }
 
+        bool is_nary_grouping() const {
+                return (type == eUnresolved) && (node->kind == eNaryGrouping);
+        }
+
+        // N-ary sums and products
+        bool is_sum() const;
+        bool is_product() const;
+
         bool is_blank() const {
                 return (type == eBlank);
         }
 
+        // Whether the operand holds a reference to a node
+        bool owns() const {
+                return (type == eUnresolved) || boxed;
+        }
+
+        // Accessors
+        Real r() const {
+                assert(type == eReal);
+                return boxed ? static_cast <const BoxedReal *> (node)->value : d;
+        }
+
+        const Rational &q() const {
+                assert(type == eRational);
+                return static_cast <const BoxedRational *> (node)->value;
+        }
+
+        // Kind of node for unresolved operands
+        int64_t kind() const {
+                assert(type == eUnresolved);
+                return node->kind;
+        }
+
+        Variable &as_variable() {
+                assert(is_variable());
+                return *reinterpret_cast <Variable *> (node);
+        }
+
+        BinaryGrouping &as_binary_grouping() {
+                assert(is_binary_grouping());
+                return *reinterpret_cast <BinaryGrouping *> (node);
+        }
+
+        const Variable &as_variable() const {
+                assert(is_variable());
+                return *reinterpret_cast <const Variable *> (node);
+        }
+
+        const BinaryGrouping &as_binary_grouping() const {
+                assert(is_binary_grouping());
+                return *reinterpret_cast <const BinaryGrouping *> (node);
+        }
+
+        NaryGrouping &as_nary_grouping() {
+                assert(is_nary_grouping());
+                return *reinterpret_cast <NaryGrouping *> (node);
+        }
+
+        const NaryGrouping &as_nary_grouping() const {
+                assert(is_nary_grouping());
+                return *reinterpret_cast <const NaryGrouping *> (node);
+        }
+
         // Printing
         std::string string(Operation * = nullptr) const;
         std::string pretty(int = 0) const;
@@ -138,44 +372,165 @@ struct Operand {
         static Operand one() {
                 return Operand { 1ll };
         }
-        
+
         // Possible types
-        Integer i;
-        Real r;
-        UnresolvedOperand uo;
-        int64_t type = eBlank;
+        union {
+                Integer i = 0;
+                double d;
+                Node *node;
+        };
+
+        int32_t type = eBlank;
+        bool boxed = false;
 };
 
+static_assert(sizeof(Operand) == 16);
+
+namespace detail {
+
+// Mixes a value into a fingerprint
+inline uint64_t mix(uint64_t seed, uint64_t value)
+{
+        uint64_t k = seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+}
+
+// Fingerprints of constants are computed, those of nodes are cached
+inline uint64_t fingerprint(const Operand &opd)
+{
+        if (opd.type == eInteger)
+                return mix(eInteger, opd.i);
+
+        if (opd.type == eReal && !opd.boxed)
+                return mix(eReal, std::bit_cast <uint64_t> (opd.d));
+
+        if (opd.owns())
+                return opd.node->fingerprint;
+
+        return 0;
+}
+
+inline uint32_t size(const Operand &opd)
+{
+        return opd.owns() ? opd.node->size : 1;
+}
+
+inline uint32_t depth(const Operand &opd)
+{
+        return opd.owns() ? opd.node->depth : 1;
+}
+
+inline uint64_t variables(const Operand &opd)
+{
+        return (opd.type == eUnresolved) ? opd.node->variables : 0;
+}
+
+// Constant, or without variables (vacuously true for blanks)
+inline bool is_constant(const Operand &opd)
+{
+        return variables(opd) == 0;
+}
+
+// Constants count as 1, or 2 if negative, variables as the length of their
+// name, and groupings as the sum of their operands; cached for nodes
+inline int64_t complexity(const Operand &opd)
+{
+        if (opd.owns())
+                return opd.node->complexity;
+
+        if (opd.is_integer())
+                return opd.i > 0 ? 1 : 2;
+
+        if (opd.is_real())
+                return opd.d > 0 ? 1 : 2;
+
+        return 0;
+}
+
+// NOTE: Private groupings are never canonical, since they may be
+// modified in place (see Operand::clone); canonicalizing
+// copies them into interned nodes
+inline bool is_canonical(const Operand &opd)
+{
+        if (!opd.owns())
+                return true;
+
+        return opd.node->canonical && (opd.node->table || opd.node->kind == eReal);
+}
+
+// Value of a constant, which may be inexact for rationals
+inline Real real(const Operand &opd)
+{
+        if (opd.is_integer())
+                return opd.i;
+
+        return opd.is_rational() ? opd.q().real() : opd.r();
+}
+
+// Exact value of an integer or rational constant
+inline Rational rational(const Operand &opd)
+{
+        return opd.is_integer() ? Rational { opd.i } : opd.q();
+}
+
+inline bool is_polynomial(const Operand &opd)
+{
+        if (opd.is_integer())
+                return true;
+
+        return (opd.type == eUnresolved) && opd.node->polynomial;
+}
+
+// Commutative and associative operations (e.g. sums and
+// products) are kept as flat groupings of sorted operands
+inline bool flattens(const Operation *op)
+{
+        constexpr uint64_t ac = eOperationCommutative | eOperationAssociative;
+        return op && (op->classifications & ac) == ac;
+}
+
+}
+
 // Variables
-struct Variable {
-        std::string lexicon;
+struct Variable : Node {
+        SymbolId symbol = 0;
+
+        Variable() : Node { eVariable } {}
+        Variable(SymbolId symbol_) : Node { eVariable }, symbol { symbol_ } {}
+        Variable(std::string_view lexicon_) : Node { eVariable }, symbol { fermat::symbol(lexicon_) } {}
 
-        Variable() = default;
-        Variable(std::string lexicon_) : lexicon { lexicon_ } {}
+        const std::string &lexicon() const {
+                return symbol_name(symbol);
+        }
 
         // TODO: store relations with other variables if being indexed...
         // e.g. x_i or y_i...
         std::string string(Operation * = nullptr) const {
-                return lexicon;
+                return lexicon();
         }
 
         std::string pretty(int indent = 0) const {
                 std::string inter(4 * indent, ' ');
-                return inter + "<variable:"  + lexicon + ">";
+                return inter + "<variable:"  + lexicon() + ">";
         }
 };
 
 // General binary grouping
-struct BinaryGrouping {
+struct BinaryGrouping : Node {
         // A binary grouping is either a single term (null op)
         // or an operation with two operands
         Operation *op = nullptr;
         Operand opda;
         Operand opdb;
 
-        BinaryGrouping() = default;
+        BinaryGrouping() : Node { eBinaryGrouping } {}
         BinaryGrouping(Operation *op_, Operand opda_, Operand opdb_)
-                : op { op_ }, opda { opda_ }, opdb { opdb_ } {
+                        : Node { eBinaryGrouping }, op { op_ }, opda { std::move(opda_) }, opdb { std::move(opdb_) } {
                 assert(op);
         }
 
@@ -217,4 +572,121 @@ struct BinaryGrouping {
         }
 };
 
+// Flat grouping of a commutative and associative operation (sums and
+// products), whose operands are kept sorted in canonical order
+struct NaryGrouping : Node {
+        using allocator_type = std::pmr::polymorphic_allocator <>;
+
+        Operation *op = nullptr;
+        std::pmr::vector <Operand> opds;
+
+        NaryGrouping(const allocator_type &allocator = {})
+                        : Node { eNaryGrouping }, opds { allocator } {}
+
+        NaryGrouping(Operation *op_, std::span <const Operand> opds_, const allocator_type &allocator = {})
+                        : Node { eNaryGrouping }, op { op_ }, opds { opds_.begin(), opds_.end(), allocator } {
+                assert(op);
+        }
+
+        NaryGrouping(const NaryGrouping &other, const allocator_type &allocator = {})
+                        : Node { other }, op { other.op }, opds { other.opds, allocator } {}
+
+        NaryGrouping(NaryGrouping &&other, const allocator_type &allocator)
+                        : Node { other }, op { other.op }, opds { std::move(other.opds), allocator } {}
+
+        NaryGrouping(NaryGrouping &&) = default;
+
+        NaryGrouping &operator=(const NaryGrouping &) = default;
+        NaryGrouping &operator=(NaryGrouping &&) = default;
+
+        // Deep clone
+        NaryGrouping clone() const {
+                NaryGrouping ng = *this;
+                for (Operand &opd : ng.opds)
+                        opd = opd.clone();
+
+                return ng;
+        }
+
+        std::string string(Operation *parent = nullptr) const {
+                std::string inter;
+                for (size_t i = 0; i < opds.size(); i++) {
+                        if (i > 0)
+                                inter += op->lexicon;
+
+                        inter += opds[i].string(op);
+                }
+
+                if (parent && op->priority < parent->priority)
+                        return "(" + inter + ")";
+
+                return inter;
+        }
+
+        std::string pretty(int indent = 0) const {
+                std::string inter = std::string(4 * indent, ' ') + "<op:" + op->lexicon + ">";
+                for (const Operand &opd : opds)
+                        inter += "\n" + opd.pretty(indent + 1);
+
+                return inter;
+        }
+};
+
+namespace detail {
+
+UniqueTable &global_table();
+
+Uptr intern(UniqueTable &, Variable &&);
+Uptr intern(UniqueTable &, BinaryGrouping &&);
+Uptr intern(UniqueTable &, NaryGrouping &&);
+Uptr intern(UniqueTable &, BoxedRational &&);
+
+// Fingerprints of node contents, e.g. of nodes which are not created yet
+uint64_t fingerprint(const Variable &);
+uint64_t fingerprint(const BinaryGrouping &);
+uint64_t fingerprint(const NaryGrouping &);
+uint64_t fingerprint(const Rational &);
+
+// Canonical order of operands: constants by value, then variables
+// by symbol, then groupings by operation and operands
+int order(const Operand &, const Operand &);
+
+// Flattens nested groupings of the same operation and
+// sorts the operands, in place
+void canonicalize(Operation *, std::vector <Operand> &);
+
+// Rewrites the expression so that all groupings of commutative and
+// associative operations are flat and sorted, so that equivalent
+// reorderings (e.g. x*y and y*x) are structurally identical; returns
+// the operand itself if it is already canonical
+Operand canonical(const Operand &);
+
+}
+
+// Nodes are hash-consed, so that structurally
+// identical nodes are only created once
+template <typename T, typename ... Args>
+Uptr new_(Args && ... args)
+{
+        return detail::intern(detail::global_table(),
+                detail::make_node <T> (nullptr, std::forward <Args> (args) ...));
+}
+
+// Same as above, but the nodes are allocated
+// inside an arena and interned in its table
+template <typename T, typename ... Args>
+Uptr arena_new(ExpressionArena &arena, Args && ... args)
+{
+        return detail::intern(arena.table(),
+                detail::make_node <T> (&arena, std::forward <Args> (args) ...));
+}
+
+// Private node which is not shared with any other
+// expression, and hence may be modified in place
+template <typename T, typename ... Args>
+Uptr private_new(Args && ... args)
+{
+        return Uptr { detail::allocate_node <T> (nullptr, std::forward <Args> (args) ...) };
+}
+
 }
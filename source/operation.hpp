@@ -7,15 +7,16 @@ namespace fermat {
 
 using OperationId = int64_t;
 
+// NOTE: Bit flags, since operations have several classifications
 enum Classifications : uint64_t {
-        eOperationNone,
-        eOperationCommutative,
-        eOperationAssociative,
-        eOperationDistributive,
-        eOperationLinear,
+        eOperationNone = 0,
+        eOperationCommutative = 1 << 0,
+        eOperationAssociative = 1 << 1,
+        eOperationDistributive = 1 << 2,
+        eOperationLinear = 1 << 3,
 };
 
-inline Classifications operator|(Classifications lhs, Classifications rhs)
+constexpr Classifications operator|(Classifications lhs, Classifications rhs)
 {
         return static_cast <Classifications>
                 (static_cast <uint64_t> (lhs)
@@ -1,5 +1,7 @@
 // Standard headers
+#include <array>
 #include <cmath>
+#include <limits>
 
 // Local headers
 #include "error.hpp"
@@ -48,128 +50,281 @@ Operation *op_exp = &g_operations[4];
 
 // TODO: overload manager to resolve between different groups of items
 // TODO: detail namespace
-inline Operand operation_function_add(const Operand &a, const Operand &b)
+
+// Numerator and denominator of integers and rationals, if both are machine integers
+static bool small(const Operand &opd, Integer &n, Integer &d)
 {
-        Operand res;
-        if (a.type == eInteger && b.type == eInteger)
-                res = Operand { a.i + b.i };
-        else if (a.type == eInteger && b.type == eReal)
-                res = Operand { static_cast <Real> (a.i) + b.r };
-        else if (a.type == eReal && b.type == eInteger)
-                res = Operand { a.r + static_cast <Real> (b.i) };
-        else if (a.type == eReal && b.type == eReal)
-                res = Operand { a.r + b.r };
-        else
-                throw std::runtime_error("add: unsupported operand types "
-                        + std::to_string(a.type) + " and " + std::to_string(b.type));
+        if (opd.is_integer()) {
+                n = opd.i;
+                d = 1;
+                return true;
+        }
 
-        return res;
+        if (!opd.is_rational())
+                return false;
+
+        std::optional <int64_t> numerator = opd.q().numerator.integer();
+        std::optional <int64_t> denominator = opd.q().denominator.integer();
+        if (!numerator || !denominator)
+                return false;
+
+        n = *numerator;
+        d = *denominator;
+        return true;
 }
 
-inline Operand operation_function_sub(const Operand &a, const Operand &b)
+// Sum or difference of small rationals, unless it overflows
+static std::optional <Operand> small_add(const Operand &a, const Operand &b, Integer sign)
 {
-        Operand res;
-        if (a.type == eInteger && b.type == eInteger)
-                res = Operand { a.i - b.i };
-        else if (a.type == eInteger && b.type == eReal)
-                res = Operand { static_cast <Real> (a.i) - b.r };
-        else if (a.type == eReal && b.type == eInteger)
-                res = Operand { a.r - static_cast <Real> (b.i) };
-        else if (a.type == eReal && b.type == eReal)
-                res = Operand { a.r - b.r };
-        else
-                throw std::runtime_error("sub: unsupported operand types "
-                        + std::to_string(a.type) + " and " + std::to_string(b.type));
-
-        return res;
+        Integer an, ad, bn, bd;
+        if (!small(a, an, ad) || !small(b, bn, bd))
+                return std::nullopt;
+
+        Integer x, y, n, d;
+        if (__builtin_mul_overflow(an, bd, &x)
+                        || __builtin_mul_overflow(bn, ad * sign, &y)
+                        || __builtin_add_overflow(x, y, &n)
+                        || __builtin_mul_overflow(ad, bd, &d))
+                return std::nullopt;
+
+        return Rational { n, d };
 }
 
-inline Operand operation_function_mul(const Operand &a, const Operand &b)
+static std::optional <Operand> small_mul(const Operand &a, const Operand &b, bool inverse)
 {
-        Operand res;
-        if (a.type == eInteger && b.type == eInteger)
-                res = Operand { a.i * b.i };
-        else if (a.type == eInteger && b.type == eReal)
-                res = Operand { static_cast <Real> (a.i) * b.r };
-        else if (a.type == eReal && b.type == eInteger)
-                res = Operand { a.r * static_cast <Real> (b.i) };
-        else if (a.type == eReal && b.type == eReal)
-                res = Operand { a.r * b.r };
-        else
-                throw std::runtime_error("mul: unsupported operand types "
-                        + std::to_string(a.type) + " and " + std::to_string(b.type));
+        Integer an, ad, bn, bd;
+        if (!small(a, an, ad) || !small(b, bn, bd))
+                return std::nullopt;
+
+        if (inverse)
+                std::swap(bn, bd);
 
-        return res;
+        Integer n, d;
+        if (__builtin_mul_overflow(an, bn, &n) || __builtin_mul_overflow(ad, bd, &d))
+                return std::nullopt;
+
+        return Rational { n, d };
 }
 
-inline Operand operation_function_div(const Operand &a, const Operand &b)
+// NOTE: Exact powers are bounded, since their size grows with the
+// exponent (e.g. 3^1000000); larger ones are computed as reals
+static constexpr uint64_t exact_power_bits = 1 << 16;
+
+static std::optional <Integer> checked_power(Integer base, Integer exponent)
 {
-        if (b.is_zero())
-                warning("div", "division by zero");
+        Integer result = 1;
+        while (true) {
+                if ((exponent & 1) && __builtin_mul_overflow(result, base, &result))
+                        return std::nullopt;
 
-        Operand res;
-        if (a.type == eInteger && b.type == eInteger) {
-                Integer ia = a.i;
-                Integer ib = b.i;
+                exponent >>= 1;
+                if (exponent == 0)
+                        return result;
 
-                if (ia % ib == 0)
-                        res = Operand { a.i / b.i };
-                else
-                        res = Operand { static_cast <Real> (a.i) / b.i };
-        } else if (a.type == eInteger && b.type == eReal) {
-                res = Operand { static_cast <Real> (a.i) / b.r };
-        } else if (a.type == eReal && b.type == eInteger) {
-                res = Operand { a.r / static_cast <Real> (b.i) };
-        } else if (a.type == eReal && b.type == eReal) {
-                res = Operand { a.r / b.r };
-        } else {
-                throw std::runtime_error("div: unsupported operand types "
-                        + std::to_string(a.type) + " and " + std::to_string(b.type));
+                if (__builtin_mul_overflow(base, base, &base))
+                        return std::nullopt;
         }
-
-        return res;
 }
 
-inline Operand operation_function_exp(const Operand &opda, const Operand &opdb)
+// Exact power of an integer or rational; the base must not be zero for
+// negative exponents
+static Operand exact_power(const Operand &opda, Integer exponent)
 {
-        Real a;
-        Real b;
+        if (opda.is_integer() && exponent >= 0) {
+                if (std::optional <Integer> i = checked_power(opda.i, exponent))
+                        return *i;
+        }
 
-        if (opda.type == eInteger)
-                a = static_cast <Real> (opda.i);
-        else
-                a = opda.r;
+        Rational base = detail::rational(opda);
+
+        uint64_t bits = std::max(base.numerator.bits(), base.denominator.bits());
+        uint64_t magnitude = (exponent < 0) ? -uint64_t(exponent) : uint64_t(exponent);
+        if (bits > 1 && magnitude > exact_power_bits / bits)
+                return std::pow(detail::real(opda), Real(exponent));
+
+        return base.power(exponent);
+}
+
+// NOTE: Constants are folded exactly unless either is a real: machine
+// integers first, with overflow checks, then rationals of arbitrary
+// precision; reals are folded in long double precision as before. Each
+// operation folds pairs of integers, pairs involving a real, and other
+// pairs of exact constants (i.e. with a rational)
+struct fold_add {
+        static Operand integer(Integer a, Integer b) {
+                Integer i;
+                if (!__builtin_add_overflow(a, b, &i))
+                        return i;
+
+                return Rational { BigInteger(a) + BigInteger(b) };
+        }
+
+        static Operand real(Real a, Real b) {
+                return a + b;
+        }
+
+        static Operand exact(const Operand &a, const Operand &b) {
+                if (std::optional <Operand> q = small_add(a, b, 1))
+                        return *q;
+
+                return detail::rational(a) + detail::rational(b);
+        }
+};
+
+struct fold_sub {
+        static Operand integer(Integer a, Integer b) {
+                Integer i;
+                if (!__builtin_sub_overflow(a, b, &i))
+                        return i;
+
+                return Rational { BigInteger(a) - BigInteger(b) };
+        }
+
+        static Operand real(Real a, Real b) {
+                return a - b;
+        }
+
+        static Operand exact(const Operand &a, const Operand &b) {
+                if (std::optional <Operand> q = small_add(a, b, -1))
+                        return *q;
+
+                return detail::rational(a) - detail::rational(b);
+        }
+};
+
+struct fold_mul {
+        static Operand integer(Integer a, Integer b) {
+                Integer i;
+                if (!__builtin_mul_overflow(a, b, &i))
+                        return i;
+
+                return Rational { BigInteger(a) * BigInteger(b) };
+        }
+
+        static Operand real(Real a, Real b) {
+                return a * b;
+        }
+
+        static Operand exact(const Operand &a, const Operand &b) {
+                if (std::optional <Operand> q = small_mul(a, b, false))
+                        return *q;
+
+                return detail::rational(a) * detail::rational(b);
+        }
+};
+
+// Inexact quotients of integers are kept as rationals (e.g. 6/4 is 3/2)
+struct fold_div {
+        static Operand integer(Integer a, Integer b) {
+                if (b == 0)
+                        return real(a, b);
+
+                // NOTE: The smallest integer over -1 overflows
+                if ((b != -1 || a != std::numeric_limits <Integer> ::min()) && a % b == 0)
+                        return a / b;
+
+                return Rational { a, b };
+        }
+
+        static Operand real(Real a, Real b) {
+                if (b == 0)
+                        warning("div", "division by zero");
+
+                return a / b;
+        }
+
+        static Operand exact(const Operand &a, const Operand &b) {
+                if (b.is_zero())
+                        return real(detail::real(a), 0);
+
+                if (std::optional <Operand> q = small_mul(a, b, true))
+                        return *q;
+
+                return detail::rational(a) / detail::rational(b);
+        }
+};
+
+// Only integer exponents of exact bases are exact
+struct fold_exp {
+        static Operand integer(Integer a, Integer b) {
+                if (a == 0 && b < 0)
+                        return real(a, b);
+
+                return exact_power(a, b);
+        }
+
+        static Operand real(Real a, Real b) {
+                return std::pow(a, b);
+        }
+
+        static Operand exact(const Operand &a, const Operand &b) {
+                if (!b.is_integer() || (a.is_zero() && b.i < 0))
+                        return real(detail::real(a), detail::real(b));
+
+                return exact_power(a, b.i);
+        }
+};
 
-        if (opdb.type == eInteger)
-                b = static_cast <Real> (opdb.i);
+// Value of a constant of a known kind
+template <int32_t K>
+static Real real(const Operand &opd)
+{
+        if constexpr (K == eInteger)
+                return opd.i;
+        else if constexpr (K == eReal)
+                return opd.r();
         else
-                b = opdb.r;
+                return opd.q().real();
+}
 
-        return std::pow(a, b);
+template <typename F, int32_t A, int32_t B>
+static Operand fold(const Operand &a, const Operand &b)
+{
+        if constexpr (A == eInteger && B == eInteger)
+                return F::integer(a.i, b.i);
+        else if constexpr (A == eReal || B == eReal)
+                return F::real(real <A> (a), real <B> (b));
+        else
+                return F::exact(a, b);
 }
 
-std::unordered_map <OperationId, binary_operation> g_operation_functions {
-        { op_add->id, operation_function_add },
-        { op_sub->id, operation_function_sub },
-        { op_mul->id, operation_function_mul },
-        { op_div->id, operation_function_div },
-        { op_exp->id, operation_function_exp },
+using fold_function = Operand (*)(const Operand &, const Operand &);
+using fold_functions = std::array <std::array <fold_function, 3>, 3>;
+
+// Indexed by the kinds of the operands, from eInteger
+static_assert(eReal == eInteger + 1 && eRational == eInteger + 2);
+
+template <typename F>
+static constexpr fold_functions fold_row {{
+        { fold <F, eInteger, eInteger>, fold <F, eInteger, eReal>, fold <F, eInteger, eRational> },
+        { fold <F, eReal, eInteger>, fold <F, eReal, eReal>, fold <F, eReal, eRational> },
+        { fold <F, eRational, eInteger>, fold <F, eRational, eReal>, fold <F, eRational, eRational> },
+}};
+
+// NOTE: In the order of g_operations
+static constexpr std::array <fold_functions, 5> fold_table {
+        fold_row <fold_add>,
+        fold_row <fold_sub>,
+        fold_row <fold_mul>,
+        fold_row <fold_div>,
+        fold_row <fold_exp>,
 };
 
 Operand opftn(const Operation *op, const Operand &opda, const Operand &opdb)
 {
-        return g_operation_functions[op->id](opda, opdb);
+        if (!opda.is_constant() || !opdb.is_constant() || size_t(op->id) >= fold_table.size())
+                throw std::runtime_error(op->lexicon + ": unsupported operand types "
+                        + std::to_string(opda.type) + " and " + std::to_string(opdb.type));
+
+        return fold_table[op->id][opda.type - eInteger][opdb.type - eInteger](opda, opdb);
 }
 
 std::unordered_map <OperationId, CommutativeInverse> commutative_inverses {
         { op_add->id, {
                 op_sub->id,
                 [](const Operand &opd) {
-                        return Operand {
-                                // TODO: just return -opd
-                                new_ <BinaryGrouping> (op_mul, -1ll, opd),
-                                eBinaryGrouping
-                        };
+                        // TODO: just return -opd
+                        return Operand { -1ll } * opd;
                 }
         }},
         { op_mul->id, {
@@ -193,16 +348,25 @@ std::unordered_map <OperationId, CommutativeInverse> commutative_inverses {
         }},
 };
 
-// Operator overloads
-// NOTE: Generates a binary grouping, but simplification must be done later
-Operand operator+(const Operand &opda, const Operand &opdb)
+// Flat grouping of the operands, in canonical order
+static Operand nary(Operation *op, const Operand &opda, const Operand &opdb)
 {
+        std::vector <Operand> opds { opda, opdb };
+        detail::canonicalize(op, opds);
+
         return Operand {
-                new_ <BinaryGrouping> (op_add, opda, opdb),
-                eBinaryGrouping
+                new_ <NaryGrouping> (op, opds),
+                eNaryGrouping
         };
 }
 
+// Operator overloads
+// NOTE: Generates a grouping, but simplification must be done later
+Operand operator+(const Operand &opda, const Operand &opdb)
+{
+        return nary(op_add, opda, opdb);
+}
+
 Operand operator-(const Operand &opda, const Operand &opdb)
 {
         return Operand {
@@ -213,10 +377,7 @@ Operand operator-(const Operand &opda, const Operand &opdb)
 
 Operand operator*(const Operand &opda, const Operand &opdb)
 {
-        return Operand {
-                new_ <BinaryGrouping> (op_mul, opda, opdb),
-                eBinaryGrouping
-        };
+        return nary(op_mul, opda, opdb);
 }
 
 Operand operator/(const Operand &opda, const Operand &opdb)
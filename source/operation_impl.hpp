@@ -9,9 +9,10 @@
 
 namespace fermat {
 
-using binary_operation = std::function <Operand (const Operand &, const Operand &)>;
-
 OperationId getid();
+
+// Folds constants, through a table indexed by the operation
+// and the kinds of the operands (see operation_impl.cpp)
 Operand opftn(const Operation *, const Operand &, const Operand &);
 
 extern Operation *op_add;
@@ -21,7 +22,6 @@ extern Operation *op_div;
 extern Operation *op_exp;
 
 extern std::vector <Operation> g_operations;
-extern std::unordered_map <OperationId, binary_operation> g_operation_functions;
 
 struct CommutativeInverse {
         OperationId id = -1;
@@ -9,46 +9,86 @@
 
 namespace fermat {
 
+// Copy of the expression with the variables replaced by their values;
+// subtrees without any of them are shared with the source
+static Operand substitute(const Operand &opd, const std::unordered_map <SymbolId, int> &ordering,
+                const std::vector <Operand> &values)
+{
+        if (detail::is_constant(opd))
+                return opd;
+
+        switch (opd.kind()) {
+        case eVariable:
+        {
+                auto it = ordering.find(opd.as_variable().symbol);
+                if (it == ordering.end() || values[it->second].is_blank())
+                        return opd;
+
+                return values[it->second];
+        }
+        case eBinaryGrouping:
+        {
+                const BinaryGrouping &bg = opd.as_binary_grouping();
+                return {
+                        new_ <BinaryGrouping> (bg.op,
+                                substitute(bg.opda, ordering, values),
+                                substitute(bg.opdb, ordering, values)),
+                        eBinaryGrouping
+                };
+        }
+        case eNaryGrouping:
+        {
+                const NaryGrouping &ng = opd.as_nary_grouping();
+
+                std::vector <Operand> opds;
+                opds.reserve(ng.opds.size());
+                for (const Operand &item : ng.opds)
+                        opds.push_back(substitute(item, ordering, values));
+
+                return { new_ <NaryGrouping> (ng.op, opds), eNaryGrouping };
+        }
+        }
+
+        throw std::runtime_error("substitute: unsupported operand type, opd=<" + opd.string() + ">");
+}
+
+Operand PartiallyEvaluated::evaluate(const std::vector <Operand> &values) const
+{
+        assert(values.size() == ordering.size());
+
+        detail::simplification_context sctx;
+        sctx.memo = memo;
+        return simplify(substitute(src, ordering, values), sctx);
+}
+
 PartiallyEvaluated partially_evaluate(const Operand &opd)
 {
         assert(!opd.is_blank());
 
-        PartiallyEvaluated pe { opd };
-        pe.opd = opd.clone();
-
         if (opd.is_constant()) {
                 warning("convert", "constant operand, opd=<" + opd.string() + ">");
-                return { opd, opd };
+                return { opd };
         }
 
-        std::set <std::string> variables;
-
-        std::stack <Operand *> stack;
-        stack.push(&pe.opd);
+        std::set <SymbolId> variables;
 
-        auto push_address = [&](const std::string &var, Operand *address) {
-                if (pe.addresses.find(var) == pe.addresses.end())
-                        pe.addresses[var] = { address };
-                else
-                        pe.addresses[var].push_back(address);
-        };
+        std::stack <const Operand *> stack;
+        stack.push(&opd);
 
         while (!stack.empty()) {
-                Operand *opd = stack.top();
+                const Operand *opd = stack.top();
                 stack.pop();
 
-                if (opd->is_constant())
+                // NOTE: Subtrees without variables are skipped whole
+                if (detail::is_constant(*opd))
                         continue;
 
-                UnresolvedOperand uo = opd->uo;
-                switch (uo.type) {
+                switch (opd->kind()) {
                 case eVariable:
-                        variables.insert(uo.as_variable().lexicon);
-                        // TODO: record location
-                        push_address(uo.as_variable().lexicon, opd);
+                        variables.insert(opd->as_variable().symbol);
                         break;
-                case eBinaryGrouping:
-                        BinaryGrouping &bg = uo.as_binary_grouping();
+                case eBinaryGrouping: {
+                        const BinaryGrouping &bg = opd->as_binary_grouping();
                         stack.push(&bg.opda);
 
                         if (!bg.degenerate())
@@ -56,14 +96,27 @@ PartiallyEvaluated partially_evaluate(const Operand &opd)
 
                         break;
                 }
+                case eNaryGrouping:
+                        for (const Operand &item : opd->as_nary_grouping().opds)
+                                stack.push(&item);
+
+                        break;
+                }
         }
 
+        PartiallyEvaluated pe { opd };
+
         // std::cout << "variables: " << variables.size() << std::endl;
         // for (const std::string &var : variables)
         //         std::cout << "  " << var << std::endl;
 
-        std::vector <std::string> sorted(variables.begin(), variables.end());
-        std::sort(sorted.begin(), sorted.end());
+        // Arguments are ordered by name
+        std::vector <SymbolId> sorted(variables.begin(), variables.end());
+        std::sort(sorted.begin(), sorted.end(),
+                [](SymbolId a, SymbolId b) {
+                        return symbol_name(a) < symbol_name(b);
+                }
+        );
 
         for (int i = 0; i < sorted.size(); i++)
                 pe.ordering[sorted[i]] = i;
@@ -71,13 +124,6 @@ PartiallyEvaluated partially_evaluate(const Operand &opd)
         // std::cout << "ordering: " << pe.ordering.size() << std::endl;
         // for (const auto &pair : pe.ordering)
         //         std::cout << "  " << pair.first << " -> " << pair.second << std::endl;
-        //
-        // std::cout << "addresses: " << pe.addresses.size() << std::endl;
-        // for (const auto &pair : pe.addresses) {
-        //         std::cout << "  " << pair.first << " -> " << pair.second.size() << std::endl;
-        //         for (Operand *address : pair.second)
-        //                 std::cout << "    " << address->pretty(1) << " @ " << address << std::endl;
-        // }
 
         return pe;
 }
@@ -2,6 +2,7 @@
 
 // Standard headers
 #include <map>
+#include <unordered_map>
 #include <iostream> // TODO: <- remove
 
 // Local headers
@@ -11,53 +12,47 @@
 
 namespace fermat {
 
+// NOTE: Evaluation substitutes into a new expression rather than
+// modifying the source, so that one object can be evaluated by
+// several threads at once
 struct PartiallyEvaluated {
-        const Operand src; // NOTE: tihs one does not change...
-        Operand opd;
+        const Operand src;
 
-        std::map <std::string, int> ordering;
-        std::map <std::string, std::vector <Operand *>> addresses;
+        std::unordered_map <SymbolId, int> ordering;
 
+        // Shared by evaluations if set
+        SimplificationMemo *memo = nullptr;
+
+        // Variables which are not given are kept as they are; names which
+        // are not variables of the expression are an error
         Operand operator()(const std::map <std::string, Operand> &values) const {
+                std::vector <Operand> substitutions(ordering.size());
                 for (const auto &pair : values) {
-                        const std::string &var = pair.first;
-                        const Operand &opd = pair.second;
-
-                        const std::vector <Operand *> &addresses = this->addresses.at(var);
-                        for (Operand *address : addresses)
-                                *address = opd;
+                        // NOTE: Looked up without interning, since
+                        // symbols are never removed
+                        std::optional <SymbolId> var = find_symbol(pair.first);
+                        auto it = var ? ordering.find(*var) : ordering.end();
+                        if (it == ordering.end())
+                                throw std::runtime_error("PartiallyEvaluated: " + pair.first + " is not a variable of the expression");
+
+                        substitutions[it->second] = pair.second;
                 }
 
-                // std::cout << "Substituted: " << opd.string() << std::endl;
-                // std::cout << "src = " << src.string() << std::endl;
-
-                detail::simplification_context sctx;
-                return simplify(opd, sctx);
+                return evaluate(substitutions);
         }
 
         template <typename ... Args>
         Operand operator()(Args ... args) const {
-                std::vector <Operand> opds = { args ... };
-                assert(opds.size() == ordering.size());
-
-                for (const auto &pair : addresses) {
-                        const std::string &var = pair.first;
-                        const std::vector <Operand *> &addresses = pair.second;
-
-                        int index = ordering.at(var);
-                        assert(index < opds.size());
+                std::vector <Operand> substitutions = { args ... };
+                assert(substitutions.size() == ordering.size());
 
-                        for (Operand *address : addresses)
-                                *address = opds[index];
-                }
-
-                // std::cout << "Substituted: " << opd.string() << std::endl;
-                // std::cout << "src = " << src.string() << std::endl;
-
-                detail::simplification_context sctx;
-                return simplify(opd, sctx);
+                return evaluate(substitutions);
         }
 
+        // Substitutes the values, in the order of the arguments,
+        // and simplifies the result; blanks are not substituted
+        Operand evaluate(const std::vector <Operand> &) const;
+
         // Generate JIT-compiled function
         JITFunction emit(OptimizationLevel level = O0, bool dump = false) {
                 // std::cout << "emitting: " << src.string() << std::endl;
@@ -81,7 +76,7 @@ struct PartiallyEvaluated {
                 // Allocate rvalues for variables
                 gccjit::param array = ctx.new_param(type_ptr, "array");
 
-                std::map <std::string, gccjit::lvalue> variables;
+                std::unordered_map <SymbolId, gccjit::lvalue> variables;
                 for (const auto &pair : ordering)
                         variables[pair.first] = array[pair.second];
 
@@ -0,0 +1,477 @@
+// Standard headers
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+
+// Local headers
+#include "memo.hpp"
+#include "operation_impl.hpp"
+#include "persistent_cache.hpp"
+#include "simplify.hpp"
+
+namespace fermat {
+
+// NOTE: Bump whenever the layout of the file changes
+static constexpr uint32_t cache_version = 2;
+static constexpr char cache_magic[8] = { 'F', 'E', 'R', 'M', 'A', 'T', 'S', 'C' };
+
+namespace detail {
+
+uint64_t operations_digest()
+{
+        uint64_t seed = mix(0, g_operations.size());
+        for (const Operation &op : g_operations) {
+                seed = mix(seed, op.id);
+                seed = mix(seed, digest(op.lexicon));
+                seed = mix(seed, op.priority);
+                seed = mix(seed, op.classifications);
+        }
+
+        return seed;
+}
+
+}
+
+// Constants are stored by value; long doubles are split into two doubles
+static detail::cache_operand constant(const Operand &opd)
+{
+        detail::cache_operand record { opd.type, 0, { 0, 0 } };
+        if (opd.type == eInteger) {
+                record.bits[0] = std::bit_cast <uint64_t> (opd.i);
+        } else if (opd.type == eReal && opd.boxed) {
+                Real r = opd.r();
+                double high = r;
+                double low = r - high;
+
+                record.boxed = 1;
+                record.bits[0] = std::bit_cast <uint64_t> (high);
+                record.bits[1] = std::bit_cast <uint64_t> (low);
+        } else if (opd.type == eReal) {
+                record.bits[0] = std::bit_cast <uint64_t> (opd.d);
+        }
+
+        return record;
+}
+
+// Serializes expressions into the sections of the file; nodes
+// which are shared (e.g. interned ones) are written once
+struct cache_writer {
+        std::vector <uint64_t> records;
+        std::unordered_map <const Node *, uint64_t> offsets;
+
+        std::vector <SymbolId> symbols;
+        std::unordered_map <SymbolId, uint64_t> indices;
+
+        template <typename T>
+        void append(const T &value) {
+                static_assert(sizeof(T) % sizeof(uint64_t) == 0);
+
+                size_t size = records.size();
+                records.resize(size + sizeof(T) / sizeof(uint64_t));
+                std::memcpy(&records[size], &value, sizeof(T));
+        }
+
+        uint64_t record(const Node *node, Operation *op, std::span <const Operand> opds) {
+                auto it = offsets.find(node);
+                if (it != offsets.end())
+                        return it->second;
+
+                // Operands first, so that they do not interleave
+                std::vector <detail::cache_operand> children;
+                for (const Operand &opd : opds)
+                        children.push_back(operand(opd));
+
+                uint64_t offset = records.size() * sizeof(uint64_t);
+                append(detail::cache_record {
+                        node->kind,
+                        int32_t(op ? op->id : -1),
+                        uint32_t(children.size()),
+                        node->size,
+                        node->fingerprint
+                });
+
+                for (const detail::cache_operand &child : children)
+                        append(child);
+
+                offsets[node] = offset;
+                return offset;
+        }
+
+        // NOTE: Records of rationals are followed by the limbs of the
+        // numerator then the denominator, padded to a whole word; the
+        // operation is the sign, and the count and size are limb counts
+        uint64_t record(const Node *node, const Rational &q) {
+                auto it = offsets.find(node);
+                if (it != offsets.end())
+                        return it->second;
+
+                uint64_t offset = records.size() * sizeof(uint64_t);
+                append(detail::cache_record {
+                        eRational,
+                        q.numerator.negative,
+                        uint32_t(q.numerator.limbs.size()),
+                        uint32_t(q.denominator.limbs.size()),
+                        node->fingerprint
+                });
+
+                std::vector <uint32_t> limbs = q.numerator.limbs;
+                limbs.insert(limbs.end(), q.denominator.limbs.begin(), q.denominator.limbs.end());
+                limbs.resize(limbs.size() + limbs.size() % 2);
+
+                size_t size = records.size();
+                records.resize(size + limbs.size() / 2);
+                std::memcpy(&records[size], limbs.data(), limbs.size() * sizeof(uint32_t));
+
+                offsets[node] = offset;
+                return offset;
+        }
+
+        detail::cache_operand operand(const Operand &opd) {
+                if (opd.is_rational())
+                        return { eRational, 1, { record(opd.node, opd.q()), 0 } };
+
+                if (!opd.owns() || opd.is_constant())
+                        return constant(opd);
+
+                if (opd.is_variable()) {
+                        SymbolId symbol = opd.as_variable().symbol;
+                        auto [it, inserted] = indices.try_emplace(symbol, symbols.size());
+                        if (inserted)
+                                symbols.push_back(symbol);
+
+                        return { eVariable, 0, { it->second, 0 } };
+                }
+
+                if (opd.is_binary_grouping()) {
+                        const BinaryGrouping &bg = opd.as_binary_grouping();
+                        const Operand opds[] = { bg.opda, bg.opdb };
+                        return { eBinaryGrouping, 0, { record(opd.node, bg.op, opds), 0 } };
+                }
+
+                if (opd.is_nary_grouping()) {
+                        const NaryGrouping &ng = opd.as_nary_grouping();
+                        return { eNaryGrouping, 0, { record(opd.node, ng.op, ng.opds), 0 } };
+                }
+
+                throw std::runtime_error("PersistentCache: unsupported operand type");
+        }
+};
+
+void PersistentCache::write(const std::string &path, const std::vector <std::pair <Operand, Operand>> &pairs)
+{
+        cache_writer writer;
+
+        // Keep the load factor under a half
+        size_t capacity = std::bit_ceil(std::max <size_t> (16, 2 * pairs.size()));
+
+        std::vector <detail::cache_bucket> buckets(capacity);
+        for (auto &bucket : buckets)
+                bucket.source.type = eBlank;
+
+        size_t entries = 0;
+        for (const auto &[source, result] : pairs) {
+                if (!source.owns() || result.is_blank())
+                        continue;
+
+                uint64_t fingerprint = detail::fingerprint(source);
+
+                size_t i = fingerprint & (capacity - 1);
+                while (buckets[i].source.type != eBlank && buckets[i].fingerprint != fingerprint)
+                        i = (i + 1) & (capacity - 1);
+
+                // Duplicates keep the first result
+                if (buckets[i].source.type != eBlank)
+                        continue;
+
+                buckets[i] = { fingerprint, writer.operand(source), writer.operand(result) };
+                entries++;
+        }
+
+        // Names are concatenated, and delimited by offsets
+        std::vector <uint64_t> delimiters { 0 };
+        std::string names;
+        for (SymbolId symbol : writer.symbols) {
+                names += symbol_name(symbol);
+                delimiters.push_back(names.size());
+        }
+
+        names.resize((names.size() + 7) & ~size_t(7));
+
+        detail::cache_header header {};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.real_bytes = sizeof(Real);
+        header.operations = detail::operations_digest();
+        header.buckets = capacity;
+        header.entries = entries;
+        header.symbols = writer.symbols.size();
+
+        header.buckets_offset = sizeof(header);
+        header.symbols_offset = header.buckets_offset + buckets.size() * sizeof(detail::cache_bucket);
+        header.records_offset = header.symbols_offset + delimiters.size() * sizeof(uint64_t);
+        header.names_offset = header.records_offset + writer.records.size() * sizeof(uint64_t);
+        header.size = header.names_offset + names.size();
+
+        // NOTE: Replaced atomically, since the file may be mapped by others
+        std::string temporary = path + ".tmp";
+        {
+                std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+                if (!file)
+                        throw std::runtime_error("PersistentCache: failed to open " + temporary);
+
+                auto bytes = [&](const auto &vector) {
+                        file.write(reinterpret_cast <const char *> (vector.data()),
+                                vector.size() * sizeof(vector[0]));
+                };
+
+                file.write(reinterpret_cast <const char *> (&header), sizeof(header));
+                bytes(buckets);
+                bytes(delimiters);
+                bytes(writer.records);
+                bytes(names);
+
+                if (!file)
+                        throw std::runtime_error("PersistentCache: failed to write " + temporary);
+        }
+
+        std::filesystem::rename(temporary, path);
+}
+
+void PersistentCache::write(const std::string &path, const detail::simplification_context &sctx)
+{
+        std::vector <std::pair <Operand, Operand>> pairs;
+        for (const auto &cachelet : sctx.cache) {
+                if (!cachelet.results.empty())
+                        pairs.push_back({ cachelet.source, cachelet.results[0] });
+        }
+
+        write(path, pairs);
+}
+
+void PersistentCache::write(const std::string &path, SimplificationMemo &memo)
+{
+        write(path, memo.snapshot());
+}
+
+// Whether a section of a number of bytes starts at an aligned offset,
+// and ends before the limit, without overflowing
+static bool section(uint64_t offset, uint64_t count, uint64_t bytes, uint64_t limit)
+{
+        return offset % sizeof(uint64_t) == 0
+                && offset <= limit
+                && count <= (limit - offset) / bytes;
+}
+
+PersistentCache::PersistentCache(const std::string &path) : file { path }
+{
+        header = at <detail::cache_header> (0);
+        if (file.size < sizeof(detail::cache_header)
+                        || std::memcmp(header->magic, cache_magic, sizeof(cache_magic))
+                        || header->size != file.size)
+                throw std::runtime_error("PersistentCache: " + path + " is not a cache file");
+
+        if (header->version != cache_version || header->real_bytes != sizeof(Real))
+                throw std::runtime_error("PersistentCache: " + path + " has an incompatible format");
+
+        if (header->operations != detail::operations_digest())
+                throw std::runtime_error("PersistentCache: " + path + " was written with different operations");
+
+        // Sections are consecutive, and the symbols section holds one
+        // more delimiter than there are symbols
+        bool valid = std::has_single_bit(header->buckets)
+                && header->entries < header->buckets
+                && header->symbols < UINT64_MAX
+                && header->buckets_offset >= sizeof(detail::cache_header)
+                && section(header->buckets_offset, header->buckets, sizeof(detail::cache_bucket), header->symbols_offset)
+                && section(header->symbols_offset, header->symbols + 1, sizeof(uint64_t), header->records_offset)
+                && section(header->records_offset, 0, 1, header->names_offset)
+                && section(header->names_offset, 0, 1, file.size);
+
+        // Names are delimited in order, within their section
+        if (valid) {
+                const uint64_t *delimiters = at <uint64_t> (header->symbols_offset);
+                for (uint64_t i = 0; valid && i < header->symbols; i++)
+                        valid = delimiters[i] <= delimiters[i + 1];
+
+                valid = valid && delimiters[0] == 0
+                        && delimiters[header->symbols] <= file.size - header->names_offset;
+        }
+
+        if (!valid)
+                throw std::runtime_error("PersistentCache: " + path + " is corrupted");
+}
+
+// NOTE: The index must be below the number of symbols
+std::string_view PersistentCache::name(uint64_t index) const
+{
+        const uint64_t *delimiters = at <uint64_t> (header->symbols_offset);
+        return {
+                file.data + header->names_offset + delimiters[index],
+                delimiters[index + 1] - delimiters[index]
+        };
+}
+
+const detail::cache_record *PersistentCache::record(const detail::cache_operand &stored, uint64_t bound) const
+{
+        uint64_t bytes = header->names_offset - header->records_offset;
+        uint64_t offset = stored.bits[0];
+        if (offset >= bound || !section(offset, 1, sizeof(detail::cache_record), bytes))
+                return nullptr;
+
+        const detail::cache_record *record = at <detail::cache_record> (header->records_offset + offset);
+        uint64_t remaining = bytes - offset - sizeof(detail::cache_record);
+
+        // Rationals are followed by their limbs, and the
+        // operation is the sign (see cache_writer::record)
+        if (stored.type == eRational) {
+                bool valid = record->kind == eRational
+                        && (record->op == 0 || record->op == 1)
+                        && record->size > 0
+                        && uint64_t(record->count) + record->size <= remaining / sizeof(uint32_t);
+
+                return valid ? record : nullptr;
+        }
+
+        bool valid = record->kind == stored.type
+                && record->op >= (stored.type == eBinaryGrouping ? -1 : 0)
+                && record->op < int64_t(g_operations.size())
+                && (stored.type == eNaryGrouping || record->count == 2)
+                && record->count <= remaining / sizeof(detail::cache_operand);
+
+        return valid ? record : nullptr;
+}
+
+// Compares the expression against the file in place, fingerprints first
+bool PersistentCache::matches(const Operand &opd, const detail::cache_operand &stored) const
+{
+        if (stored.type == eVariable) {
+                return opd.is_variable() && stored.bits[0] < header->symbols
+                        && opd.as_variable().lexicon() == name(stored.bits[0]);
+        }
+
+        if (stored.type != eRational && stored.type != eBinaryGrouping && stored.type != eNaryGrouping)
+                return (!opd.owns() || opd.is_constant()) && constant(opd) == stored;
+
+        if (stored.type == eRational ? !opd.is_rational() : (opd.type != eUnresolved || opd.kind() != stored.type))
+                return false;
+
+        const detail::cache_record *record = this->record(stored, UINT64_MAX);
+        if (!record || record->fingerprint != opd.node->fingerprint)
+                return false;
+
+        // Limbs are compared in place, without loading the rational
+        if (opd.is_rational()) {
+                const Rational &q = opd.q();
+                const uint32_t *limbs = reinterpret_cast <const uint32_t *> (record + 1);
+                return record->op == q.numerator.negative
+                        && record->count == q.numerator.limbs.size()
+                        && record->size == q.denominator.limbs.size()
+                        && std::equal(q.numerator.limbs.begin(), q.numerator.limbs.end(), limbs)
+                        && std::equal(q.denominator.limbs.begin(), q.denominator.limbs.end(), limbs + record->count);
+        }
+
+        const detail::cache_operand *opds = reinterpret_cast <const detail::cache_operand *> (record + 1);
+        if (opd.is_binary_grouping()) {
+                const BinaryGrouping &bg = opd.as_binary_grouping();
+                return record->op == (bg.op ? bg.op->id : -1)
+                        && matches(bg.opda, opds[0])
+                        && matches(bg.opdb, opds[1]);
+        }
+
+        const NaryGrouping &ng = opd.as_nary_grouping();
+        if (record->op != ng.op->id || record->count != ng.opds.size())
+                return false;
+
+        for (size_t i = 0; i < ng.opds.size(); i++) {
+                if (!matches(ng.opds[i], opds[i]))
+                        return false;
+        }
+
+        return true;
+}
+
+// NOTE: Operands are written before the records which refer to them, so
+// records are only loaded below the offset of their parent; corrupted
+// files cannot make loading cycle
+Operand PersistentCache::load(const detail::cache_operand &stored, uint64_t bound) const
+{
+        switch (stored.type) {
+        case eBlank:
+                return {};
+        case eInteger:
+                return std::bit_cast <Integer> (stored.bits[0]);
+        case eReal:
+                return Real(std::bit_cast <double> (stored.bits[0]))
+                        + Real(std::bit_cast <double> (stored.bits[1]));
+        case eVariable:
+                if (stored.bits[0] >= header->symbols)
+                        throw std::runtime_error("PersistentCache: unknown symbol in a corrupted record");
+
+                return { new_ <Variable> (symbol(name(stored.bits[0]))), eVariable };
+        case eRational:
+        case eBinaryGrouping:
+        case eNaryGrouping:
+                break;
+        default:
+                throw std::runtime_error("PersistentCache: unknown operand type in a corrupted record");
+        }
+
+        const detail::cache_record *record = this->record(stored, bound);
+        if (!record)
+                throw std::runtime_error("PersistentCache: corrupted record");
+
+        if (record->kind == eRational) {
+                const uint32_t *limbs = reinterpret_cast <const uint32_t *> (record + 1);
+
+                Rational q;
+                q.numerator.limbs.assign(limbs, limbs + record->count);
+                q.numerator.negative = record->op;
+                q.denominator.limbs.assign(limbs + record->count, limbs + record->count + record->size);
+                return q;
+        }
+
+        const detail::cache_operand *opds = reinterpret_cast <const detail::cache_operand *> (record + 1);
+
+        Operation *op = (record->op >= 0) ? &g_operations[record->op] : nullptr;
+        if (record->kind == eBinaryGrouping) {
+                BinaryGrouping bg;
+                bg.op = op;
+                bg.opda = load(opds[0], stored.bits[0]);
+                bg.opdb = load(opds[1], stored.bits[0]);
+                return { new_ <BinaryGrouping> (std::move(bg)), eBinaryGrouping };
+        }
+
+        std::vector <Operand> items;
+        items.reserve(record->count);
+        for (uint32_t i = 0; i < record->count; i++)
+                items.push_back(load(opds[i], stored.bits[0]));
+
+        return { new_ <NaryGrouping> (op, items), eNaryGrouping };
+}
+
+std::optional <Operand> PersistentCache::find(const Operand &source) const
+{
+        if (!source.owns() || source.is_constant())
+                return std::nullopt;
+
+        const detail::cache_bucket *buckets = at <detail::cache_bucket> (header->buckets_offset);
+
+        uint64_t fingerprint = detail::fingerprint(source);
+        uint64_t mask = header->buckets - 1;
+        uint64_t i = fingerprint & mask;
+        for (uint64_t probes = 0; probes < header->buckets && buckets[i].source.type != eBlank; probes++) {
+                if (buckets[i].fingerprint == fingerprint && matches(source, buckets[i].source))
+                        return load(buckets[i].result);
+
+                i = (i + 1) & mask;
+        }
+
+        return std::nullopt;
+}
+
+}
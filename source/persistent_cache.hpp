@@ -0,0 +1,118 @@
+#pragma once
+
+// Standard headers
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Local headers
+#include "mapped_file.hpp"
+#include "operand.hpp"
+
+namespace fermat {
+
+struct SimplificationMemo;
+
+namespace detail {
+
+struct simplification_context;
+
+// Layout of the cache file; everything is stored in native byte
+// order and aligned to eight bytes, so that the file is used in place
+struct cache_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t real_bytes;
+
+        // Digest of the operations table the file was written with
+        uint64_t operations;
+
+        uint64_t buckets;
+        uint64_t entries;
+        uint64_t symbols;
+
+        // Byte offsets of the sections
+        uint64_t buckets_offset;
+        uint64_t symbols_offset;
+        uint64_t records_offset;
+        uint64_t names_offset;
+
+        uint64_t size;
+};
+
+// Constants are stored inline, variables by their index in the
+// symbol section and groupings by the offset of their record
+struct cache_operand {
+        int32_t type;
+        uint32_t boxed;
+        uint64_t bits[2];
+
+        bool operator==(const cache_operand &) const = default;
+};
+
+// Followed by its operands
+struct cache_record {
+        int32_t kind;
+        int32_t op;
+        uint32_t count;
+        uint32_t size;
+        uint64_t fingerprint;
+};
+
+// Open addressing by fingerprint; empty buckets have a blank source
+struct cache_bucket {
+        uint64_t fingerprint;
+        cache_operand source;
+        cache_operand result;
+};
+
+// Digest of the contents of g_operations
+uint64_t operations_digest();
+
+}
+
+// Simplified expressions saved to disk, e.g. to be shared between runs;
+// the file is memory mapped and looked up in place, and expressions are
+// only built on a hit
+struct PersistentCache {
+        MappedFile file;
+
+        const detail::cache_header *header;
+
+        // NOTE: Throws if the file is not a cache, or if it was written
+        // with a different operations table (or platform)
+        PersistentCache(const std::string &);
+
+        // Expressions are expected to be canonical (see detail::canonical)
+        std::optional <Operand> find(const Operand &) const;
+
+        size_t size() const {
+                return header->entries;
+        }
+
+        // Writes pairs of canonical source expressions and their simplified forms
+        static void write(const std::string &, const std::vector <std::pair <Operand, Operand>> &);
+        static void write(const std::string &, const detail::simplification_context &);
+        static void write(const std::string &, SimplificationMemo &);
+private:
+        template <typename T>
+        const T *at(uint64_t offset) const {
+                return reinterpret_cast <const T *> (file.data + offset);
+        }
+
+        std::string_view name(uint64_t) const;
+
+        // Record which a stored operand refers to, if it lies within the
+        // records section (below the bound) along with its operands or
+        // limbs, and its fields are consistent; null otherwise
+        const detail::cache_record *record(const detail::cache_operand &, uint64_t) const;
+
+        // NOTE: Stored values are checked before they are used; corrupted
+        // ones never match, and loading them throws
+        bool matches(const Operand &, const detail::cache_operand &) const;
+        Operand load(const detail::cache_operand &, uint64_t = UINT64_MAX) const;
+};
+
+}
@@ -0,0 +1,328 @@
+// Standard headers
+#include <algorithm>
+#include <limits>
+
+// Local headers
+#include "operation_impl.hpp"
+#include "polynomial.hpp"
+#include "debugging.hpp"
+
+namespace fermat {
+
+size_t MonomialHash::operator()(const Monomial &monomial) const
+{
+        uint64_t seed = 0;
+        for (const auto &[symbol, exponent] : monomial.powers)
+                seed = detail::mix(detail::mix(seed, symbol), exponent);
+
+        return seed;
+}
+
+// Merges the sorted powers of both monomials
+static std::optional <Monomial> multiply(const Monomial &a, const Monomial &b)
+{
+        Monomial c;
+        c.powers.reserve(a.powers.size() + b.powers.size());
+
+        size_t i = 0;
+        size_t j = 0;
+        while (i < a.powers.size() || j < b.powers.size()) {
+                if (j == b.powers.size() || (i < a.powers.size() && a.powers[i].first < b.powers[j].first)) {
+                        c.powers.push_back(a.powers[i++]);
+                } else if (i == a.powers.size() || b.powers[j].first < a.powers[i].first) {
+                        c.powers.push_back(b.powers[j++]);
+                } else {
+                        uint32_t exponent;
+                        if (__builtin_add_overflow(a.powers[i].second, b.powers[j].second, &exponent))
+                                return std::nullopt;
+
+                        c.powers.push_back({ a.powers[i].first, exponent });
+                        i++, j++;
+                }
+        }
+
+        return c;
+}
+
+Polynomial Polynomial::constant(Integer c)
+{
+        Polynomial p;
+        if (c != 0)
+                p.terms.emplace(Monomial {}, c);
+
+        return p;
+}
+
+Polynomial Polynomial::variable(SymbolId symbol)
+{
+        Polynomial p;
+        p.terms.emplace(Monomial { { { symbol, 1 } } }, 1);
+        return p;
+}
+
+std::optional <Polynomial> Polynomial::add(const Polynomial &other, Integer sign) const
+{
+        Polynomial p = *this;
+        for (const auto &[monomial, coefficient] : other.terms) {
+                Integer scaled;
+                if (__builtin_mul_overflow(coefficient, sign, &scaled))
+                        return std::nullopt;
+
+                auto [it, inserted] = p.terms.try_emplace(monomial, scaled);
+                if (inserted)
+                        continue;
+
+                if (__builtin_add_overflow(it->second, scaled, &it->second))
+                        return std::nullopt;
+
+                if (it->second == 0)
+                        p.terms.erase(it);
+        }
+
+        return p;
+}
+
+std::optional <Polynomial> Polynomial::multiply(const Polynomial &other, const PolynomialLimits &bounds) const
+{
+        if (terms.size() * other.terms.size() > bounds.work)
+                return std::nullopt;
+
+        Polynomial p;
+        for (const auto &[ma, ca] : terms) {
+                for (const auto &[mb, cb] : other.terms) {
+                        std::optional <Monomial> monomial = fermat::multiply(ma, mb);
+
+                        Integer coefficient;
+                        if (!monomial || __builtin_mul_overflow(ca, cb, &coefficient))
+                                return std::nullopt;
+
+                        auto [it, inserted] = p.terms.try_emplace(std::move(*monomial), coefficient);
+                        if (!inserted && __builtin_add_overflow(it->second, coefficient, &it->second))
+                                return std::nullopt;
+                }
+        }
+
+        std::erase_if(p.terms, [](const auto &term) { return term.second == 0; });
+        if (p.terms.size() > bounds.terms)
+                return std::nullopt;
+
+        return p;
+}
+
+// By repeated squaring
+std::optional <Polynomial> Polynomial::power(Integer exponent, const PolynomialLimits &bounds) const
+{
+        if (exponent < 0)
+                return std::nullopt;
+
+        Polynomial result = constant(1);
+        Polynomial base = *this;
+        while (true) {
+                if (exponent & 1) {
+                        std::optional <Polynomial> next = result.multiply(base, bounds);
+                        if (!next)
+                                return std::nullopt;
+
+                        result = std::move(*next);
+                }
+
+                exponent >>= 1;
+                if (exponent == 0)
+                        return result;
+
+                std::optional <Polynomial> squared = base.multiply(base, bounds);
+                if (!squared)
+                        return std::nullopt;
+
+                base = std::move(*squared);
+        }
+}
+
+std::optional <Polynomial> Polynomial::from(const Operand &opd, const PolynomialLimits &bounds)
+{
+        if (opd.is_integer())
+                return constant(opd.i);
+
+        if (!detail::is_polynomial(opd))
+                return std::nullopt;
+
+        if (opd.is_variable())
+                return variable(opd.as_variable().symbol);
+
+        if (opd.is_nary_grouping()) {
+                const NaryGrouping &ng = opd.as_nary_grouping();
+
+                bool sum = (ng.op->id == op_add->id);
+
+                std::optional <Polynomial> p = constant(sum ? 0 : 1);
+                for (const Operand &item : ng.opds) {
+                        std::optional <Polynomial> q = from(item, bounds);
+                        if (!q)
+                                return std::nullopt;
+
+                        p = sum ? p->add(*q) : p->multiply(*q, bounds);
+                        if (!p || p->terms.size() > bounds.terms)
+                                return std::nullopt;
+                }
+
+                return p;
+        }
+
+        const BinaryGrouping &bg = opd.as_binary_grouping();
+        if (bg.degenerate())
+                return from(bg.opda, bounds);
+
+        std::optional <Polynomial> a = from(bg.opda, bounds);
+        if (!a)
+                return std::nullopt;
+
+        if (bg.op->id == op_exp->id)
+                return a->power(bg.opdb.i, bounds);
+
+        std::optional <Polynomial> b = from(bg.opdb, bounds);
+        if (!b)
+                return std::nullopt;
+
+        std::optional <Polynomial> p;
+        if (bg.op->id == op_add->id)
+                p = a->add(*b);
+        else if (bg.op->id == op_sub->id)
+                p = a->add(*b, -1);
+        else
+                p = a->multiply(*b, bounds);
+
+        if (p && p->terms.size() > bounds.terms)
+                return std::nullopt;
+
+        return p;
+}
+
+Operand Polynomial::operand() const
+{
+        std::vector <Operand> items;
+        items.reserve(terms.size());
+
+        for (const auto &[monomial, coefficient] : terms) {
+                std::vector <Operand> factors;
+                if (coefficient != 1 || monomial.powers.empty())
+                        factors.push_back(coefficient);
+
+                for (const auto &[symbol, exponent] : monomial.powers) {
+                        Operand var { new_ <Variable> (symbol), eVariable };
+                        if (exponent == 1)
+                                factors.push_back(var);
+                        else
+                                factors.push_back({ new_ <BinaryGrouping> (op_exp, var, Integer(exponent)), eBinaryGrouping });
+                }
+
+                if (factors.size() == 1) {
+                        items.push_back(factors[0]);
+                } else {
+                        detail::canonicalize(op_mul, factors);
+                        items.push_back({ new_ <NaryGrouping> (op_mul, factors), eNaryGrouping });
+                }
+        }
+
+        if (items.empty())
+                return Operand::zero();
+
+        if (items.size() == 1)
+                return items[0];
+
+        detail::canonicalize(op_add, items);
+        return { new_ <NaryGrouping> (op_add, items), eNaryGrouping };
+}
+
+namespace detail {
+
+// Integers, variables, their powers and products thereof
+static bool is_monomial(const Operand &opd, bool nested = false)
+{
+        if (opd.is_integer() || opd.is_variable())
+                return true;
+
+        if (opd.is_binary_grouping()) {
+                const BinaryGrouping &bg = opd.as_binary_grouping();
+                return is_polynomial(opd) && !bg.degenerate()
+                        && bg.op->id == op_exp->id && bg.opda.is_variable();
+        }
+
+        if (nested || !opd.is_product())
+                return false;
+
+        for (const Operand &item : opd.as_nary_grouping().opds) {
+                if (!is_monomial(item, true))
+                        return false;
+        }
+
+        return true;
+}
+
+// NOTE: Expanding may make the items larger (e.g. (x + 1) * (x + 1)), in
+// which case they are kept as they are; a normal form with more terms than
+// the items have nodes is never smaller, so the expansion is abandoned as
+// soon as it reaches that many terms
+void simplification_polynomial(Operation *focus, std::vector <Operand> &items, bool expand)
+{
+        if (focus->id != op_add->id && focus->id != op_mul->id)
+                return;
+
+        auto candidate = [&](const Operand &opd) {
+                return expand ? is_polynomial(opd) : is_monomial(opd);
+        };
+
+        if (std::count_if(items.begin(), items.end(), candidate) < 2)
+                return;
+
+        bool sum = (focus->id == op_add->id);
+
+        PolynomialLimits bounds;
+        bounds.terms = 1;
+        for (const Operand &opd : items)
+                bounds.terms += size(opd);
+
+        std::vector <Operand> others;
+        std::optional <Polynomial> p = Polynomial::constant(sum ? 0 : 1);
+
+        size_t combined = 0;
+        uint32_t before = 1;
+        for (const Operand &opd : items) {
+                if (!p || !candidate(opd)) {
+                        others.push_back(opd);
+                        continue;
+                }
+
+                std::optional <Polynomial> q = Polynomial::from(opd, bounds);
+                if (!q) {
+                        others.push_back(opd);
+                        continue;
+                }
+
+                p = sum ? p->add(*q) : p->multiply(*q, bounds);
+                combined++;
+                before += size(opd);
+        }
+
+        if (!p || combined < 2)
+                return;
+
+        Operand normal = p->operand();
+        if (size(normal) > before)
+                return;
+
+        // NOTE: Kept flat, so that the factors of a monomial
+        // may still gather with other items (e.g. y * y^-1)
+        FERMAT_LOG("Combined " << combined << " polynomial items into " << normal.string() << "\n");
+        if (normal.is_nary_grouping() && normal.as_nary_grouping().op->id == focus->id) {
+                const NaryGrouping &ng = normal.as_nary_grouping();
+                others.insert(others.end(), ng.opds.begin(), ng.opds.end());
+        } else {
+                others.push_back(normal);
+        }
+
+        items = std::move(others);
+}
+
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+// Standard headers
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Local headers
+#include "operand.hpp"
+
+namespace fermat {
+
+// Product of variables, as (symbol, exponent) pairs sorted by symbol;
+// the empty monomial is the constant term
+struct Monomial {
+        std::vector <std::pair <SymbolId, uint32_t>> powers;
+
+        bool operator==(const Monomial &) const = default;
+};
+
+struct MonomialHash {
+        size_t operator()(const Monomial &) const;
+};
+
+// Bounds expansion, which may blow up (e.g. (x + y)^1000); work is
+// the number of term products a single multiplication may take
+struct PolynomialLimits {
+        size_t terms = 1024;
+        size_t work = 1 << 20;
+};
+
+// Sparse multivariate polynomial with exact integer coefficients; like
+// terms share a monomial, so they are combined as they are added. Zero
+// coefficients are never stored, so the zero polynomial has no terms
+struct Polynomial {
+        std::unordered_map <Monomial, Integer, MonomialHash> terms;
+
+        static Polynomial constant(Integer);
+        static Polynomial variable(SymbolId);
+
+        // Results are empty if a coefficient or exponent overflows, or if
+        // a limit is hit; conversion also fails for non-polynomial operands
+        static std::optional <Polynomial> from(const Operand &, const PolynomialLimits & = {});
+
+        std::optional <Polynomial> add(const Polynomial &, Integer = 1) const;
+        std::optional <Polynomial> multiply(const Polynomial &, const PolynomialLimits & = {}) const;
+        std::optional <Polynomial> power(Integer, const PolynomialLimits & = {}) const;
+
+        // Expanded sum of products, in canonical form
+        Operand operand() const;
+};
+
+namespace detail {
+
+// Combines the polynomial items of a sum or product into their normal form,
+// in place, if that does not make them larger; the other items are kept as
+// they are. Unless expanding, only monomials are combined (i.e. like terms)
+void simplification_polynomial(Operation *, std::vector <Operand> &, bool = true);
+
+}
+
+}
@@ -0,0 +1,542 @@
+// Standard headers
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+// Local headers
+#include "rational.hpp"
+
+namespace fermat {
+
+using Limbs = std::vector <uint32_t>;
+
+static void trim(Limbs &limbs)
+{
+        while (!limbs.empty() && limbs.back() == 0)
+                limbs.pop_back();
+}
+
+static int compare_magnitude(const Limbs &a, const Limbs &b)
+{
+        if (a.size() != b.size())
+                return (a.size() < b.size()) ? -1 : 1;
+
+        for (size_t i = a.size(); i-- > 0; ) {
+                if (a[i] != b[i])
+                        return (a[i] < b[i]) ? -1 : 1;
+        }
+
+        return 0;
+}
+
+static Limbs add_magnitude(const Limbs &a, const Limbs &b)
+{
+        const Limbs &longer = (a.size() < b.size()) ? b : a;
+        const Limbs &shorter = (a.size() < b.size()) ? a : b;
+
+        Limbs c(longer.size() + 1);
+
+        uint64_t carry = 0;
+        for (size_t i = 0; i < longer.size(); i++) {
+                uint64_t t = uint64_t(longer[i]) + (i < shorter.size() ? shorter[i] : 0) + carry;
+                c[i] = uint32_t(t);
+                carry = t >> 32;
+        }
+
+        c.back() = carry;
+        trim(c);
+        return c;
+}
+
+// NOTE: The magnitude of a must be at least that of b
+static Limbs subtract_magnitude(const Limbs &a, const Limbs &b)
+{
+        Limbs c(a.size());
+
+        int64_t borrow = 0;
+        for (size_t i = 0; i < a.size(); i++) {
+                int64_t t = int64_t(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+                borrow = (t < 0);
+                c[i] = uint32_t(t + (borrow << 32));
+        }
+
+        trim(c);
+        return c;
+}
+
+static Limbs multiply_magnitude(const Limbs &a, const Limbs &b)
+{
+        if (a.empty() || b.empty())
+                return {};
+
+        Limbs c(a.size() + b.size());
+        for (size_t i = 0; i < a.size(); i++) {
+                uint64_t carry = 0;
+                for (size_t j = 0; j < b.size(); j++) {
+                        uint64_t t = uint64_t(a[i]) * b[j] + c[i + j] + carry;
+                        c[i + j] = uint32_t(t);
+                        carry = t >> 32;
+                }
+
+                c[i + b.size()] = carry;
+        }
+
+        trim(c);
+        return c;
+}
+
+// Long division (Knuth, algorithm D); the divisor must not be zero
+static std::pair <Limbs, Limbs> divide_magnitude(const Limbs &u, const Limbs &v)
+{
+        if (compare_magnitude(u, v) < 0)
+                return { {}, u };
+
+        if (v.size() == 1) {
+                Limbs q(u.size());
+
+                uint64_t r = 0;
+                for (size_t i = u.size(); i-- > 0; ) {
+                        uint64_t t = (r << 32) | u[i];
+                        q[i] = t / v[0];
+                        r = t % v[0];
+                }
+
+                trim(q);
+
+                Limbs rem { uint32_t(r) };
+                trim(rem);
+                return { q, rem };
+        }
+
+        // Normalize, so that the leading limb of the divisor has its top bit set
+        size_t n = v.size();
+        size_t m = u.size() - n;
+        int s = std::countl_zero(v.back());
+
+        Limbs vn(n);
+        for (size_t i = n - 1; i > 0; i--)
+                vn[i] = (v[i] << s) | (s ? uint64_t(v[i - 1]) >> (32 - s) : 0);
+        vn[0] = v[0] << s;
+
+        Limbs un(u.size() + 1);
+        un[u.size()] = s ? uint64_t(u.back()) >> (32 - s) : 0;
+        for (size_t i = u.size() - 1; i > 0; i--)
+                un[i] = (u[i] << s) | (s ? uint64_t(u[i - 1]) >> (32 - s) : 0);
+        un[0] = u[0] << s;
+
+        constexpr uint64_t base = 1ull << 32;
+
+        Limbs q(m + 1);
+        for (size_t j = m + 1; j-- > 0; ) {
+                uint64_t numerator = (uint64_t(un[j + n]) << 32) | un[j + n - 1];
+                uint64_t qhat = numerator / vn[n - 1];
+                uint64_t rhat = numerator % vn[n - 1];
+
+                while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+                        qhat--;
+                        rhat += vn[n - 1];
+                        if (rhat >= base)
+                                break;
+                }
+
+                // Multiply and subtract
+                int64_t k = 0;
+                int64_t t = 0;
+                for (size_t i = 0; i < n; i++) {
+                        uint64_t p = qhat * vn[i];
+                        t = int64_t(un[i + j]) - k - int64_t(p & 0xffffffff);
+                        un[i + j] = uint32_t(t);
+                        k = int64_t(p >> 32) - (t >> 32);
+                }
+
+                t = int64_t(un[j + n]) - k;
+                un[j + n] = uint32_t(t);
+
+                q[j] = qhat;
+
+                // Subtracted too much, so add back
+                if (t < 0) {
+                        q[j]--;
+
+                        uint64_t carry = 0;
+                        for (size_t i = 0; i < n; i++) {
+                                uint64_t sum = uint64_t(un[i + j]) + vn[i] + carry;
+                                un[i + j] = uint32_t(sum);
+                                carry = sum >> 32;
+                        }
+
+                        un[j + n] += carry;
+                }
+        }
+
+        Limbs r(n);
+        for (size_t i = 0; i < n; i++)
+                r[i] = (un[i] >> s) | (s ? uint64_t(un[i + 1]) << (32 - s) : 0);
+
+        trim(q);
+        trim(r);
+        return { q, r };
+}
+
+BigInteger::BigInteger(int64_t value)
+{
+        *this = magnitude(value < 0 ? -uint64_t(value) : uint64_t(value), value < 0);
+}
+
+BigInteger BigInteger::magnitude(uint64_t value, bool negative)
+{
+        BigInteger n;
+        if (value) {
+                n.limbs.push_back(uint32_t(value));
+                if (value >> 32)
+                        n.limbs.push_back(uint32_t(value >> 32));
+
+                n.negative = negative;
+        }
+
+        return n;
+}
+
+uint64_t BigInteger::bits() const
+{
+        if (limbs.empty())
+                return 0;
+
+        return 32 * limbs.size() - std::countl_zero(limbs.back());
+}
+
+std::optional <int64_t> BigInteger::integer() const
+{
+        if (limbs.size() > 2)
+                return std::nullopt;
+
+        uint64_t value = 0;
+        for (size_t i = limbs.size(); i-- > 0; )
+                value = (value << 32) | limbs[i];
+
+        if (negative) {
+                if (value > (uint64_t(1) << 63))
+                        return std::nullopt;
+
+                return int64_t(-value);
+        }
+
+        if (value >= (uint64_t(1) << 63))
+                return std::nullopt;
+
+        return int64_t(value);
+}
+
+long double BigInteger::mantissa(int64_t &exponent) const
+{
+        exponent = 0;
+        if (limbs.size() <= 2) {
+                uint64_t value = 0;
+                for (size_t i = limbs.size(); i-- > 0; )
+                        value = (value << 32) | limbs[i];
+
+                return value;
+        }
+
+        // The leading limbs, with those below them as an exponent
+        size_t i = limbs.size();
+        uint64_t value = (uint64_t(limbs[i - 1]) << 32) | limbs[i - 2];
+        long double low = limbs[i - 3];
+
+        exponent = 32 * (i - 3);
+        return value * 4294967296.0l + low;
+}
+
+long double BigInteger::real() const
+{
+        int64_t exponent;
+        long double value = mantissa(exponent);
+
+        // NOTE: The exponent must be read after mantissa sets it
+        value = std::ldexp(value, int(exponent));
+        return negative ? -value : value;
+}
+
+// In chunks of nine digits
+std::string BigInteger::string() const
+{
+        if (limbs.empty())
+                return "0";
+
+        static const Limbs billion { 1000000000 };
+
+        std::vector <uint32_t> chunks;
+
+        Limbs value = limbs;
+        while (!value.empty()) {
+                auto [q, r] = divide_magnitude(value, billion);
+                chunks.push_back(r.empty() ? 0 : r[0]);
+                value = std::move(q);
+        }
+
+        std::string s = negative ? "-" : "";
+        s += std::to_string(chunks.back());
+        for (size_t i = chunks.size() - 1; i-- > 0; ) {
+                std::string chunk = std::to_string(chunks[i]);
+                s += std::string(9 - chunk.size(), '0') + chunk;
+        }
+
+        return s;
+}
+
+// In chunks of nine digits, as with string
+std::optional <BigInteger> BigInteger::decimal(std::string_view digits)
+{
+        if (digits.empty())
+                return std::nullopt;
+
+        BigInteger value;
+        for (size_t i = 0; i < digits.size(); i += 9) {
+                std::string_view chunk = digits.substr(i, 9);
+
+                uint32_t scale = 1;
+                uint32_t n = 0;
+                for (char c : chunk) {
+                        if (c < '0' || c > '9')
+                                return std::nullopt;
+
+                        scale *= 10;
+                        n = 10 * n + (c - '0');
+                }
+
+                value = value * BigInteger(scale) + BigInteger(n);
+        }
+
+        return value;
+}
+
+BigInteger BigInteger::operator-() const
+{
+        BigInteger n = *this;
+        n.negative = !n.limbs.empty() && !negative;
+        return n;
+}
+
+std::pair <BigInteger, BigInteger> BigInteger::divide(const BigInteger &a, const BigInteger &b)
+{
+        if (b.is_zero())
+                throw std::runtime_error("BigInteger: division by zero");
+
+        auto [q, r] = divide_magnitude(a.limbs, b.limbs);
+
+        BigInteger quotient;
+        quotient.limbs = std::move(q);
+        quotient.negative = !quotient.limbs.empty() && (a.negative != b.negative);
+
+        BigInteger remainder;
+        remainder.limbs = std::move(r);
+        remainder.negative = !remainder.limbs.empty() && a.negative;
+
+        return { quotient, remainder };
+}
+
+int compare(const BigInteger &a, const BigInteger &b)
+{
+        if (a.negative != b.negative)
+                return a.negative ? -1 : 1;
+
+        int c = compare_magnitude(a.limbs, b.limbs);
+        return a.negative ? -c : c;
+}
+
+BigInteger operator+(const BigInteger &a, const BigInteger &b)
+{
+        BigInteger c;
+        if (a.negative == b.negative) {
+                c.limbs = add_magnitude(a.limbs, b.limbs);
+                c.negative = a.negative;
+        } else if (compare_magnitude(a.limbs, b.limbs) >= 0) {
+                c.limbs = subtract_magnitude(a.limbs, b.limbs);
+                c.negative = a.negative;
+        } else {
+                c.limbs = subtract_magnitude(b.limbs, a.limbs);
+                c.negative = b.negative;
+        }
+
+        c.negative = c.negative && !c.limbs.empty();
+        return c;
+}
+
+BigInteger operator-(const BigInteger &a, const BigInteger &b)
+{
+        return a + (-b);
+}
+
+BigInteger operator*(const BigInteger &a, const BigInteger &b)
+{
+        BigInteger c;
+        c.limbs = multiply_magnitude(a.limbs, b.limbs);
+        c.negative = !c.limbs.empty() && (a.negative != b.negative);
+        return c;
+}
+
+BigInteger gcd(BigInteger a, BigInteger b)
+{
+        a.negative = false;
+        b.negative = false;
+
+        while (!b.is_zero()) {
+                BigInteger r = BigInteger::divide(a, b).second;
+                a = std::move(b);
+                b = std::move(r);
+        }
+
+        return a;
+}
+
+Rational::Rational(BigInteger n) : numerator { std::move(n) } {}
+
+Rational::Rational(BigInteger n, BigInteger d)
+{
+        if (d.is_zero())
+                throw std::runtime_error("Rational: zero denominator");
+
+        if (d.negative) {
+                n = -n;
+                d = -d;
+        }
+
+        BigInteger g = gcd(n, d);
+        if (g.limbs.size() != 1 || g.limbs[0] != 1) {
+                n = BigInteger::divide(n, g).first;
+                d = BigInteger::divide(d, g).first;
+        }
+
+        numerator = std::move(n);
+        denominator = std::move(d);
+}
+
+// NOTE: Magnitudes are unsigned, since negating the
+// smallest integer overflows
+Rational::Rational(int64_t n, int64_t d)
+{
+        if (d == 0)
+                throw std::runtime_error("Rational: zero denominator");
+
+        uint64_t un = (n < 0) ? -uint64_t(n) : uint64_t(n);
+        uint64_t ud = (d < 0) ? -uint64_t(d) : uint64_t(d);
+
+        uint64_t g = std::gcd(un, ud);
+        numerator = BigInteger::magnitude(un / g, (n < 0) != (d < 0));
+        denominator = BigInteger::magnitude(ud / g);
+}
+
+bool Rational::is_integer() const
+{
+        return denominator.limbs.size() == 1 && denominator.limbs[0] == 1;
+}
+
+// Leading bits of each, so that large values do not overflow
+long double Rational::real() const
+{
+        int64_t en;
+        int64_t ed;
+
+        long double value = numerator.mantissa(en) / denominator.mantissa(ed);
+        value = std::ldexp(value, int(en - ed));
+        return numerator.negative ? -value : value;
+}
+
+std::string Rational::string() const
+{
+        if (is_integer())
+                return numerator.string();
+
+        return numerator.string() + "/" + denominator.string();
+}
+
+// By repeated squaring
+Rational Rational::power(int64_t exponent) const
+{
+        Rational base = *this;
+        if (exponent < 0)
+                base = Rational { 1 } / base;
+
+        uint64_t e = (exponent < 0) ? -uint64_t(exponent) : uint64_t(exponent);
+
+        // Powers of reduced fractions are reduced
+        Rational result;
+        result.numerator = 1;
+        while (true) {
+                if (e & 1) {
+                        result.numerator = result.numerator * base.numerator;
+                        result.denominator = result.denominator * base.denominator;
+                }
+
+                e >>= 1;
+                if (e == 0)
+                        return result;
+
+                base.numerator = base.numerator * base.numerator;
+                base.denominator = base.denominator * base.denominator;
+        }
+}
+
+int compare(const Rational &a, const Rational &b)
+{
+        if (a.is_integer() && b.is_integer())
+                return compare(a.numerator, b.numerator);
+
+        // Cross products of machine integers fit in 128 bits
+        std::optional <int64_t> an = a.numerator.integer();
+        std::optional <int64_t> ad = a.denominator.integer();
+        std::optional <int64_t> bn = b.numerator.integer();
+        std::optional <int64_t> bd = b.denominator.integer();
+        if (an && ad && bn && bd) {
+                __int128 x = __int128(*an) * *bd;
+                __int128 y = __int128(*bn) * *ad;
+                return (x < y) ? -1 : (y < x);
+        }
+
+        return compare(a.numerator * b.denominator, b.numerator * a.denominator);
+}
+
+Rational operator+(const Rational &a, const Rational &b)
+{
+        if (a.is_integer() && b.is_integer())
+                return a.numerator + b.numerator;
+
+        return {
+                a.numerator * b.denominator + b.numerator * a.denominator,
+                a.denominator * b.denominator
+        };
+}
+
+Rational operator-(const Rational &a, const Rational &b)
+{
+        if (a.is_integer() && b.is_integer())
+                return a.numerator - b.numerator;
+
+        return {
+                a.numerator * b.denominator - b.numerator * a.denominator,
+                a.denominator * b.denominator
+        };
+}
+
+Rational operator*(const Rational &a, const Rational &b)
+{
+        if (a.is_integer() && b.is_integer())
+                return a.numerator * b.numerator;
+
+        return {
+                a.numerator * b.numerator,
+                a.denominator * b.denominator
+        };
+}
+
+Rational operator/(const Rational &a, const Rational &b)
+{
+        return {
+                a.numerator * b.denominator,
+                a.denominator * b.numerator
+        };
+}
+
+}
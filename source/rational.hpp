@@ -0,0 +1,96 @@
+#pragma once
+
+// Standard headers
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fermat {
+
+// Arbitrary precision integer, as a sign and a magnitude of 32-bit limbs
+// (least significant first, without leading zeros); zero has no limbs
+struct BigInteger {
+        std::vector <uint32_t> limbs;
+        bool negative = false;
+
+        BigInteger() = default;
+        BigInteger(int64_t);
+
+        static BigInteger magnitude(uint64_t, bool = false);
+
+        // Non-negative value of a string of decimal digits, if it is one
+        static std::optional <BigInteger> decimal(std::string_view);
+
+        bool is_zero() const {
+                return limbs.empty();
+        }
+
+        // Number of bits of the magnitude
+        uint64_t bits() const;
+
+        // Value, if it fits in 64 bits
+        std::optional <int64_t> integer() const;
+
+        // Leading 64 bits of the magnitude, and their exponent
+        long double mantissa(int64_t &) const;
+
+        long double real() const;
+        std::string string() const;
+
+        BigInteger operator-() const;
+
+        bool operator==(const BigInteger &) const = default;
+
+        // Truncated quotient and remainder, as with built-in integers
+        static std::pair <BigInteger, BigInteger> divide(const BigInteger &, const BigInteger &);
+};
+
+int compare(const BigInteger &, const BigInteger &);
+
+BigInteger operator+(const BigInteger &, const BigInteger &);
+BigInteger operator-(const BigInteger &, const BigInteger &);
+BigInteger operator*(const BigInteger &, const BigInteger &);
+
+// Non-negative
+BigInteger gcd(BigInteger, BigInteger);
+
+// Exact quotient of integers, kept with a positive
+// denominator which has no common factor with the numerator
+struct Rational {
+        BigInteger numerator;
+        BigInteger denominator = 1;
+
+        Rational() = default;
+        Rational(BigInteger);
+
+        // NOTE: The denominator must not be zero
+        Rational(BigInteger, BigInteger);
+
+        // Reduces with machine integers, which is cheaper
+        Rational(int64_t, int64_t);
+
+        bool is_integer() const;
+        bool is_negative() const {
+                return numerator.negative;
+        }
+
+        long double real() const;
+        std::string string() const;
+
+        // NOTE: The value must not be zero for negative exponents
+        Rational power(int64_t) const;
+
+        bool operator==(const Rational &) const = default;
+};
+
+int compare(const Rational &, const Rational &);
+
+Rational operator+(const Rational &, const Rational &);
+Rational operator-(const Rational &, const Rational &);
+Rational operator*(const Rational &, const Rational &);
+Rational operator/(const Rational &, const Rational &);
+
+}
@@ -0,0 +1,388 @@
+// Standard headers
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+// Local headers
+#include "expr.hpp"
+#include "operation_impl.hpp"
+#include "rewrite.hpp"
+#include "simplify.hpp"
+#include "symbol_table.hpp"
+
+namespace fermat {
+
+const Operand *RewriteBindings::find(SymbolId symbol) const
+{
+        for (const auto &[s, opd] : values) {
+                if (s == symbol)
+                        return &opd;
+        }
+
+        return nullptr;
+}
+
+const Operand &RewriteBindings::operator[](SymbolId symbol) const
+{
+        if (const Operand *opd = find(symbol))
+                return *opd;
+
+        throw std::runtime_error("rewrite: unbound pattern variable " + symbol_name(symbol));
+}
+
+const Operand &RewriteBindings::operator[](std::string_view name) const
+{
+        if (rule) {
+                for (const auto &[variable, symbol] : rule->variables) {
+                        if (variable == name)
+                                return (*this)[symbol];
+                }
+        }
+
+        throw std::runtime_error("rewrite: unbound pattern variable " + std::string(name));
+}
+
+static void push_children(const Operand &, std::vector <const Operand *> &);
+
+static Operand parse_rule(std::string_view name, std::string_view source)
+{
+        std::optional <Operand> opd = parse(source);
+        if (!opd)
+                throw std::runtime_error("rewrite rule " + std::string(name) + ": failed to parse " + std::string(source));
+
+        return detail::canonical(*opd);
+}
+
+// Distinct variables of a pattern, in preorder
+static std::vector <std::pair <std::string, SymbolId>> pattern_variables(const Operand &pattern)
+{
+        std::vector <std::pair <std::string, SymbolId>> variables;
+
+        std::vector <const Operand *> stack { &pattern };
+        while (!stack.empty()) {
+                const Operand *opd = stack.back();
+                stack.pop_back();
+
+                if (opd->is_variable()) {
+                        SymbolId symbol = opd->as_variable().symbol;
+                        bool seen = std::any_of(variables.begin(), variables.end(),
+                                [&](const auto &variable) { return variable.second == symbol; });
+                        if (!seen)
+                                variables.push_back({ symbol_name(symbol), symbol });
+                } else if (!opd->is_constant()) {
+                        push_children(*opd, stack);
+                }
+        }
+
+        return variables;
+}
+
+RewriteRule::RewriteRule(std::string_view name_, std::string_view pattern_, std::string_view replacement_,
+                std::function <bool (const RewriteBindings &)> condition_)
+                : name { name_ },
+                pattern { parse_rule(name_, pattern_) },
+                replacement { parse_rule(name_, replacement_) },
+                variables { pattern_variables(pattern) },
+                condition { std::move(condition_) } {}
+
+size_t RewriteSystem::symbol_hash::operator()(const symbol &sym) const
+{
+        return detail::mix(detail::mix(sym.kind, sym.value), sym.arity);
+}
+
+// NOTE: Constants are keyed by their value as a double, so that integers and
+// reals of the same value share an edge; matching compares them exactly
+static RewriteSystem::symbol symbol_of(const Operand &opd)
+{
+        if (opd.is_constant()) {
+                double value = detail::real(opd);
+                return { eInteger, std::bit_cast <uint64_t> (value + 0.0), 0 };
+        }
+
+        switch (opd.kind()) {
+        case eVariable:
+                return { eVariable, opd.as_variable().symbol, 0 };
+        case eBinaryGrouping:
+                return { eBinaryGrouping, uint64_t(opd.as_binary_grouping().op->id), 2 };
+        case eNaryGrouping:
+                return { eNaryGrouping, uint64_t(opd.as_nary_grouping().op->id), opd.as_nary_grouping().opds.size() };
+        }
+
+        throw std::runtime_error("rewrite: unsupported operand type");
+}
+
+// Operands in order, so that they are pushed in reverse
+static void push_children(const Operand &opd, std::vector <const Operand *> &stack)
+{
+        if (opd.is_binary_grouping()) {
+                stack.push_back(&opd.as_binary_grouping().opdb);
+                stack.push_back(&opd.as_binary_grouping().opda);
+        } else if (opd.is_nary_grouping()) {
+                const std::pmr::vector <Operand> &opds = opd.as_nary_grouping().opds;
+                for (auto it = opds.rbegin(); it != opds.rend(); it++)
+                        stack.push_back(&*it);
+        }
+}
+
+static bool variables_bound(const Operand &opd, const Operand &pattern)
+{
+        if (opd.is_variable()) {
+                std::vector <const Operand *> stack { &pattern };
+                while (!stack.empty()) {
+                        const Operand *item = stack.back();
+                        stack.pop_back();
+
+                        if (item->is_variable() && item->as_variable().symbol == opd.as_variable().symbol)
+                                return true;
+
+                        if (!item->is_constant())
+                                push_children(*item, stack);
+                }
+
+                return false;
+        }
+
+        std::vector <const Operand *> children;
+        if (!opd.is_constant())
+                push_children(opd, children);
+
+        return std::all_of(children.begin(), children.end(),
+                [&](const Operand *child) { return variables_bound(*child, pattern); });
+}
+
+void RewriteSystem::add(RewriteRule rule)
+{
+        if (!variables_bound(rule.replacement, rule.pattern))
+                throw std::runtime_error("rewrite rule " + rule.name + ": replacement has unbound variables");
+
+        uint32_t node = 0;
+
+        std::vector <const Operand *> stack { &rule.pattern };
+        while (!stack.empty()) {
+                const Operand *opd = stack.back();
+                stack.pop_back();
+
+                if (opd->is_variable()) {
+                        if (trie[node].wildcard == -1) {
+                                trie[node].wildcard = trie.size();
+                                trie.emplace_back();
+                        }
+
+                        node = trie[node].wildcard;
+                        continue;
+                }
+
+                symbol sym = symbol_of(*opd);
+
+                auto it = trie[node].children.find(sym);
+                if (it == trie[node].children.end()) {
+                        it = trie[node].children.emplace(sym, trie.size()).first;
+                        trie.emplace_back();
+                }
+
+                node = it->second;
+                push_children(*opd, stack);
+        }
+
+        trie[node].rules.push_back(rules.size());
+        rules.push_back(std::move(rule));
+}
+
+// The stack holds the subexpressions which are still to be matched, and is
+// restored before returning; every node is reached through a single path
+void RewriteSystem::retrieve(uint32_t node, std::vector <const Operand *> &stack, std::vector <uint32_t> &out) const
+{
+        const trie_node &tn = trie[node];
+        if (stack.empty()) {
+                out.insert(out.end(), tn.rules.begin(), tn.rules.end());
+                return;
+        }
+
+        const Operand *opd = stack.back();
+        stack.pop_back();
+
+        if (tn.wildcard != -1)
+                retrieve(tn.wildcard, stack, out);
+
+        if (!tn.children.empty()) {
+                auto it = tn.children.find(symbol_of(*opd));
+                if (it != tn.children.end()) {
+                        size_t depth = stack.size();
+                        push_children(*opd, stack);
+                        retrieve(it->second, stack, out);
+                        stack.resize(depth);
+                }
+        }
+
+        stack.push_back(opd);
+}
+
+std::vector <uint32_t> RewriteSystem::candidates(const Operand &opd) const
+{
+        std::vector <uint32_t> out;
+        std::vector <const Operand *> stack { &opd };
+        retrieve(0, stack, out);
+
+        std::sort(out.begin(), out.end());
+        return out;
+}
+
+static bool match(const Operand &pattern, const Operand &opd, RewriteBindings &bindings)
+{
+        if (pattern.is_variable()) {
+                SymbolId symbol = pattern.as_variable().symbol;
+                if (const Operand *bound = bindings.find(symbol))
+                        return detail::cmp(*bound, opd);
+
+                bindings.values.push_back({ symbol, opd });
+                return true;
+        }
+
+        if (pattern.is_constant()) {
+                if (!opd.is_constant())
+                        return false;
+
+                if (pattern.is_integer() && opd.is_integer())
+                        return pattern.i == opd.i;
+
+                if (pattern.is_real() || opd.is_real())
+                        return detail::real(pattern) == detail::real(opd);
+
+                return detail::rational(pattern) == detail::rational(opd);
+        }
+
+        if (pattern.is_binary_grouping()) {
+                if (!opd.is_binary_grouping())
+                        return false;
+
+                const BinaryGrouping &bgp = pattern.as_binary_grouping();
+                const BinaryGrouping &bgo = opd.as_binary_grouping();
+                return bgp.op->id == bgo.op->id
+                        && match(bgp.opda, bgo.opda, bindings)
+                        && match(bgp.opdb, bgo.opdb, bindings);
+        }
+
+        if (pattern.is_nary_grouping()) {
+                if (!opd.is_nary_grouping())
+                        return false;
+
+                const NaryGrouping &ngp = pattern.as_nary_grouping();
+                const NaryGrouping &ngo = opd.as_nary_grouping();
+                if (ngp.op->id != ngo.op->id || ngp.opds.size() != ngo.opds.size())
+                        return false;
+
+                for (size_t i = 0; i < ngp.opds.size(); i++) {
+                        if (!match(ngp.opds[i], ngo.opds[i], bindings))
+                                return false;
+                }
+
+                return true;
+        }
+
+        return false;
+}
+
+static Operand instantiate(const Operand &replacement, const RewriteBindings &bindings)
+{
+        if (replacement.is_constant())
+                return replacement;
+
+        if (replacement.is_variable())
+                return *bindings.find(replacement.as_variable().symbol);
+
+        if (replacement.is_binary_grouping()) {
+                const BinaryGrouping &bg = replacement.as_binary_grouping();
+
+                Operand opda = instantiate(bg.opda, bindings);
+                Operand opdb = instantiate(bg.opdb, bindings);
+                if (opda.is_constant() && opdb.is_constant())
+                        return opftn(bg.op, opda, opdb);
+
+                return detail::canonical({ new_ <BinaryGrouping> (bg.op, opda, opdb), eBinaryGrouping });
+        }
+
+        const NaryGrouping &ng = replacement.as_nary_grouping();
+
+        std::vector <Operand> opds;
+        for (const Operand &opd : ng.opds)
+                opds.push_back(instantiate(opd, bindings));
+
+        // Constants are ordered first, so they are combined in one pass
+        detail::canonicalize(ng.op, opds);
+
+        size_t constants = 0;
+        while (constants < opds.size() && opds[constants].is_constant())
+                constants++;
+
+        if (constants > 1) {
+                Operand c = opds[0];
+                for (size_t i = 1; i < constants; i++)
+                        c = opftn(ng.op, c, opds[i]);
+
+                opds.erase(opds.begin() + 1, opds.begin() + constants);
+                opds[0] = c;
+        }
+
+        if (opds.size() == 1)
+                return opds[0];
+
+        return { new_ <NaryGrouping> (ng.op, opds), eNaryGrouping };
+}
+
+std::optional <Operand> RewriteSystem::rewrite(const Operand &opd) const
+{
+        if (opd.is_blank() || opd.is_constant())
+                return std::nullopt;
+
+        Operand subject = detail::canonical(opd);
+        for (uint32_t index : candidates(subject)) {
+                const RewriteRule &rule = rules[index];
+
+                RewriteBindings bindings;
+                bindings.rule = &rule;
+                if (!match(rule.pattern, subject, bindings))
+                        continue;
+
+                if (rule.condition && !rule.condition(bindings))
+                        continue;
+
+                return instantiate(rule.replacement, bindings);
+        }
+
+        return std::nullopt;
+}
+
+namespace detail {
+
+static bool negative(const Operand &opd)
+{
+        return opd.is_constant() && real(opd) < 0;
+}
+
+// NOTE: x^0 comes first, so that 0^0 is 1
+const RewriteSystem &simplification_rules()
+{
+        static const RewriteSystem system = [] {
+                RewriteSystem system;
+                system.add({ "additive identity", "0 + x", "x" });
+                system.add({ "multiplicative identity", "1 * x", "x" });
+                system.add({ "multiplicative zero", "0 * x", "0" });
+                system.add({ "zero exponent", "x^0", "1" });
+                system.add({ "unit exponent", "x^1", "x" });
+                system.add({ "zero base", "0^x", "0" });
+                system.add({ "unit base", "1^x", "1" });
+                system.add({ "negative exponent", "x^n", "1/x^(0 - n)",
+                        [](const RewriteBindings &bindings) {
+                                return negative(bindings["n"]);
+                        }
+                });
+
+                return system;
+        } ();
+
+        return system;
+}
+
+}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+// Standard headers
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Local headers
+#include "operand.hpp"
+
+namespace fermat {
+
+struct RewriteRule;
+
+// Values of the pattern variables of a rule which matched
+struct RewriteBindings {
+        std::vector <std::pair <SymbolId, Operand>> values;
+
+        // Rule which matched, whose variables are named
+        const RewriteRule *rule = nullptr;
+
+        const Operand *find(SymbolId) const;
+
+        // The variable must be bound; names are resolved through
+        // the variables of the rule, without the symbol table
+        const Operand &operator[](SymbolId) const;
+        const Operand &operator[](std::string_view) const;
+};
+
+// Declarative rewrite rule, e.g. x^1 => x; every variable of the pattern is a
+// pattern variable, which matches any subexpression (the same one wherever it
+// appears), and constants match constants of the same value. Groupings of
+// the replacement whose operands are all constants are folded
+struct RewriteRule {
+        std::string name;
+        Operand pattern;
+        Operand replacement;
+
+        // Pattern variables, resolved once when the rule is built
+        std::vector <std::pair <std::string, SymbolId>> variables;
+
+        // Side condition on the bindings, if any
+        std::function <bool (const RewriteBindings &)> condition;
+
+        RewriteRule(std::string_view, std::string_view, std::string_view,
+                std::function <bool (const RewriteBindings &)> = {});
+};
+
+// Rules compiled into a discrimination tree over the preorder symbols of
+// their patterns, where pattern variables are wildcards which skip a whole
+// subexpression; only the rules along the paths that a subject expression
+// follows are tried, so the cost per expression does not grow with the
+// number of rules. Of the rules which match, the earliest added is applied
+struct RewriteSystem {
+        // Operation or constant at the root of a subexpression
+        struct symbol {
+                int64_t kind;
+                uint64_t value;
+                uint64_t arity;
+
+                bool operator==(const symbol &) const = default;
+        };
+
+        struct symbol_hash {
+                size_t operator()(const symbol &) const;
+        };
+
+        struct trie_node {
+                std::unordered_map <symbol, uint32_t, symbol_hash> children;
+                int64_t wildcard = -1;
+
+                // Rules whose patterns end here
+                std::vector <uint32_t> rules;
+        };
+
+        std::vector <RewriteRule> rules;
+        std::vector <trie_node> trie { 1 };
+
+        void add(RewriteRule);
+
+        // Indices of the rules whose patterns may match, in order
+        std::vector <uint32_t> candidates(const Operand &) const;
+
+        // Applies the first matching rule at the root of the expression
+        std::optional <Operand> rewrite(const Operand &) const;
+private:
+        void retrieve(uint32_t, std::vector <const Operand *> &, std::vector <uint32_t> &) const;
+};
+
+namespace detail {
+
+// Identities of the aggressive simplification pass
+const RewriteSystem &simplification_rules();
+
+}
+
+}
@@ -3,8 +3,15 @@
 #include <limits>
 
 // Local headers
+#include "incremental.hpp"
+#include "memo.hpp"
+#include "persistent_cache.hpp"
+#include "polynomial.hpp"
+#include "rewrite.hpp"
 #include "simplify.hpp"
+#include "thread_pool.hpp"
 #include "operation_impl.hpp"
+#include "unique_table.hpp"
 #include "error.hpp"
 #include "debugging.hpp"
 
@@ -23,29 +30,8 @@ namespace fermat {
 // NOTE: we instead need some parity information wrt an operation
 // of the expression; e.g. for 2x is 0 and for -2x is 1
 
-bool is_constant(const Operand &opd)
-{
-        // Constant or vacuously true
-        if (opd.is_constant() || opd.is_blank())
-                return true;
-
-        // Unresolved operand
-        if (opd.uo.type == eBinaryGrouping) {
-                BinaryGrouping bg = opd.uo.as_binary_grouping();
-                if (!is_constant(bg.opda))
-                        return false;
-
-                if (!bg.degenerate() && !is_constant(bg.opdb))
-                        return false;
-
-                return true;
-        }
-
-        return false;
-}
-
 // TODO: maybe these are also detail namespaces?
-std::vector <Operand> unfold(const Operation *focus, const BinaryGrouping &bg)
+std::vector <Operand> unfold(const Operation *focus, const Operand &origin)
 {
         assert(focus->classifications & eOperationCommutative);
 
@@ -57,13 +43,12 @@ std::vector <Operand> unfold(const Operation *focus, const BinaryGrouping &bg)
         };
 
         std::stack <stack_item > stack;
-
-        Operand origin = Operand { new_ <BinaryGrouping> (bg), eBinaryGrouping };
         stack.push({ origin, true });
 
+        // NOTE: Not indexed, since the table is shared between threads
         CommutativeInverse ci;
-        if (commutative_inverses.find(focus->id) != commutative_inverses.end())
-                ci = commutative_inverses[focus->id];
+        if (auto it = commutative_inverses.find(focus->id); it != commutative_inverses.end())
+                ci = it->second;
         else
                 warning("unfold", "no recorded inverse for commutative operation " + focus->lexicon);
 
@@ -78,13 +63,22 @@ std::vector <Operand> unfold(const Operation *focus, const BinaryGrouping &bg)
                         continue;
                 }
 
-                UnresolvedOperand uo = opd.uo;
-                switch (uo.type) {
+                switch (opd.kind()) {
                 case eVariable:
                         items.push_back(opd);
+                        break;
+                case eNaryGrouping:
+                        // Already flat
+                        if (opd.as_nary_grouping().op->id == focus->id) {
+                                for (const Operand &item : opd.as_nary_grouping().opds)
+                                        stack.push({ item, si.canon_inverse });
+                        } else {
+                                items.push_back(opd);
+                        }
+
                         break;
                 case eBinaryGrouping:
-                        BinaryGrouping bg_nested = uo.as_binary_grouping();
+                        BinaryGrouping bg_nested = opd.as_binary_grouping();
                         if (bg_nested.degenerate()) {
                                 stack.push({ bg_nested.opda, si.canon_inverse });
                                 break;
@@ -96,7 +90,7 @@ std::vector <Operand> unfold(const Operation *focus, const BinaryGrouping &bg)
                         } else if (bg_nested.op->id == ci.id) {
                                 // TODO: for nested inverse commutative
                                 // operations, the order of B or A switches
-                                // lout << "[*]  Inverse branch: " << bg_nested.string() << "\n";
+                                // FERMAT_LOG("[*]  Inverse branch: " << bg_nested.string() << "\n");
 
                                 if (!si.canon_inverse)
                                         std::swap(bg_nested.opda, bg_nested.opdb);
@@ -114,13 +108,18 @@ std::vector <Operand> unfold(const Operation *focus, const BinaryGrouping &bg)
                 }
         }
 
-        // lout << "Result of unfolding:\n";
+        // FERMAT_LOG("Result of unfolding:\n");
         // for (Operand opd : items)
-        //         lout << opd.string() << "\n";
+        //         FERMAT_LOG(opd.string() << "\n");
 
         return items;
 }
 
+std::vector <Operand> unfold(const Operation *focus, const BinaryGrouping &bg)
+{
+        return unfold(focus, Operand { new_ <BinaryGrouping> (bg), eBinaryGrouping });
+}
+
 Operand fold(Operation *op, const std::vector <Operand> &opds)
 {
         if (opds.size() == 0) {
@@ -128,106 +127,64 @@ Operand fold(Operation *op, const std::vector <Operand> &opds)
                 return Operand {};
         }
 
-        lout << "Folding with operation: " << op->lexicon << "\n";
+        FERMAT_LOG("Folding with operation: " << op->lexicon << "\n");
         for (Operand opd : opds)
-                lout << "  $ " << opd.string() << "\n";
+                FERMAT_LOG("  $ " << opd.string() << "\n");
 
         // Makes sure that we can fold the operation
-        // in a binary partition fashion
+        // into a single flat grouping
         assert(op->classifications & eOperationCommutative);
 
-        std::vector <Operand> current = opds;
-        std::vector <Operand> next;
-
-        while (current.size() > 1) {
-                for (size_t i = 0; i < current.size(); i += 2) {
-                        if (i + 1 < current.size()) {
-                                Operand a = current[i];
-                                Operand b = current[i + 1];
-
-                                if (a.is_constant() && b.is_constant()) {
-                                        Operand res = opftn(op, a, b);
-                                        next.push_back(res);
-                                } else {
-                                        BinaryGrouping bg = { op, a, b };
-                                        next.push_back({ new_ <BinaryGrouping> (bg), eBinaryGrouping });
-                                }
-                        } else {
-                                next.push_back(current[i]);
-                        }
-                }
+        if (opds.size() == 1)
+                return opds[0];
+
+        std::vector <Operand> items = opds;
+        detail::canonicalize(op, items);
+
+        // Constants are ordered first, so they are combined in one pass
+        size_t constants = 0;
+        while (constants < items.size() && items[constants].is_constant())
+                constants++;
 
-                assert(next.size() < current.size());
-                current = next;
-                next.clear();
+        if (constants > 1) {
+                Operand c = items[0];
+                for (size_t i = 1; i < constants; i++)
+                        c = opftn(op, c, items[i]);
+
+                items.erase(items.begin() + 1, items.begin() + constants);
+                items[0] = c;
         }
 
-        return current[0];
+        if (items.size() == 1)
+                return items[0];
+
+        return Operand { new_ <NaryGrouping> (op, items), eNaryGrouping };
 }
 
 namespace detail {
 
-ExpressionHash hash(const Operand &);
-
+// Hashes of nodes are cached, those of groupings
+// which are not nodes yet are computed from their operands
 ExpressionHash hash(const BinaryGrouping &bg)
 {
-        ExpressionHash hash_a = hash(bg.opda);
-        ExpressionHash hash_b = hash(bg.opdb);
-
-        std::vector <int64_t> hash { bg.op->id };
-        hash.insert(hash.end(), hash_a.linear.begin(), hash_a.linear.end());
-        hash.insert(hash.end(), hash_b.linear.begin(), hash_b.linear.end());
-
-        return ExpressionHash { hash };
+        return { fingerprint(bg), 1 + size(bg.opda) + size(bg.opdb) };
 }
 
-ExpressionHash hash(const Operand &opd)
+ExpressionHash hash(const NaryGrouping &ng)
 {
-        if (opd.is_constant()) {
-                int64_t hash = (opd.type == eInteger) ?
-                        std::bit_cast <int64_t, Integer> (opd.i)
-                        : std::bit_cast <int64_t, double> (opd.r);
-
-                return ExpressionHash { { hash } };
-        }
-
-        UnresolvedOperand uo = opd.uo;
-        if (uo.type == eVariable) {
-                // TODO: compress with 8 chars per hash
-                std::vector <int64_t> hash;
-                for (char c : uo.as_variable().lexicon)
-                        hash.push_back(c);
-
-                return ExpressionHash { hash };
-        }
-
-        if (uo.type == eBinaryGrouping) {
-                BinaryGrouping bg = uo.as_binary_grouping();
-                return hash(bg);
-        }
+        uint32_t count = 1;
+        for (const Operand &opd : ng.opds)
+                count += size(opd);
 
-        throw std::runtime_error("hash: unknown operand type");
+        return { fingerprint(ng), count };
 }
 
-int64_t cmp(const ExpressionHash &a, const ExpressionHash &b)
+ExpressionHash hash(const Operand &opd)
 {
-        // TODO: return the size of best match (e.g. factor out common subexpressions)
-        int64_t min = 0;
-
-        // In order comparison first
-        uint64_t size = std::min(a.linear.size(), b.linear.size());
-        for (size_t i = 0; i < size; i++)
-                min += std::abs(a.linear[i] - b.linear[i]);
-
-        for (size_t i = size; i < a.linear.size(); i++)
-                min += std::abs(a.linear[i]);
-
-        for (size_t i = size; i < b.linear.size(); i++)
-                min += std::abs(b.linear[i]);
+        if (opd.is_blank())
+                throw std::runtime_error("hash: unknown operand type");
 
-        // TODO: commutativity and inverses, etc
-
-        return min;
+        return { fingerprint(opd), size(opd) };
 }
 
 bool cmp(const Operand &a, const Operand &b)
@@ -242,179 +199,228 @@ bool cmp(const Operand &a, const Operand &b)
                         return a.i == b.i;
 
                 if (a.type == eReal && b.type == eReal)
-                        return a.r == b.r;
+                        return a.r() == b.r();
+
+                if (a.type == eRational && b.type == eRational)
+                        return a.q() == b.q();
 
                 return a.type == b.type;
         }
 
-        if (a.uo.type != b.uo.type)
+        if (a.kind() != b.kind())
                 return false;
 
-        UnresolvedOperand uoa = a.uo;
-        UnresolvedOperand uob = b.uo;
+        if (a.node == b.node)
+                return true;
 
-        if (uoa.type == eVariable && uob.type == eVariable)
-                return uoa.as_variable().lexicon == uob.as_variable().lexicon;
+        // NOTE: Interned nodes are only unique within their table if their
+        // children are too (e.g. not with children from an arena), so they
+        // are compared structurally; their fingerprints cannot change, and
+        // rule out most of them first
+        if (a.node->table && b.node->table && a.node->fingerprint != b.node->fingerprint)
+                return false;
 
-        if (uoa.type == eBinaryGrouping && uob.type == eBinaryGrouping) {
-                BinaryGrouping bga = uoa.as_binary_grouping();
-                BinaryGrouping bgb = uob.as_binary_grouping();
+        if (a.is_variable() && b.is_variable())
+                return a.as_variable().symbol == b.as_variable().symbol;
+
+        if (a.is_binary_grouping() && b.is_binary_grouping()) {
+                const BinaryGrouping &bga = a.as_binary_grouping();
+                const BinaryGrouping &bgb = b.as_binary_grouping();
 
                 return (bga.op->id == bgb.op->id)
                         && cmp(bga.opda, bgb.opda)
                         && cmp(bga.opdb, bgb.opdb);
         }
 
+        if (a.is_nary_grouping() && b.is_nary_grouping()) {
+                const NaryGrouping &nga = a.as_nary_grouping();
+                const NaryGrouping &ngb = b.as_nary_grouping();
+
+                if (nga.op->id != ngb.op->id || nga.opds.size() != ngb.opds.size())
+                        return false;
+
+                for (size_t i = 0; i < nga.opds.size(); i++) {
+                        if (!cmp(nga.opds[i], ngb.opds[i]))
+                                return false;
+                }
+
+                return true;
+        }
+
         warning("cmp", "unknown operand type");
         return false;
 }
 
-// TODO: different header...
-// Perceptual complexity score as a heuristic for simplifying and factoring expressions
-int64_t perceptual_complexity(const Operand &opd)
+const simplification_context::cachelet *simplification_context::find(const ExpressionHash &hash, const Operand &source) const
 {
-        if (opd.is_constant()) {
-                if (opd.is_integer())
-                        return opd.i > 0 ? 1 : 2;
+        size_t probe = 0;
+
+        const cachelet *found = nullptr;
+        for (const simplification_context *scope = this; scope && !found; scope = scope->parent) {
+                if (scope->index.empty())
+                        continue;
+
+                const std::vector <int32_t> &index = scope->index;
 
-                if (opd.is_real())
-                        return opd.r > 0 ? 1 : 2;
+                size_t mask = index.size() - 1;
+                for (size_t i = hash.fingerprint & mask; index[i] != -1; i = (i + 1) & mask) {
+                        probe++;
+
+                        const cachelet &entry = scope->cache[index[i]];
+                        if (entry.hash == hash && cmp(entry.source, source)) {
+                                found = &entry;
+                                break;
+                        }
+                }
         }
 
-        UnresolvedOperand uo = opd.uo;
-        if (uo.type == eVariable)
-                return uo.as_variable().lexicon.size();
+        stats.probes += probe;
+        stats.longest_probe = std::max(stats.longest_probe, probe);
+        if (found)
+                stats.hits++;
+        else
+                stats.misses++;
 
-        if (uo.type == eBinaryGrouping) {
-                BinaryGrouping bg = uo.as_binary_grouping();
+        return found;
+}
 
-                int64_t op_cost = 1;
-                if (bg.op->id == op_div->id)
-                        op_cost = 2;
-                if (bg.op->id == op_exp->id)
-                        op_cost = 3;
+bool simplification_budget::step()
+{
+        if (expired())
+                return false;
 
-                return perceptual_complexity(bg.opda) + perceptual_complexity(bg.opdb);
-        }
+        Budget reason = eBudgetNone;
+        if (steps.fetch_add(1, std::memory_order_relaxed) >= options.steps)
+                reason = eBudgetSteps;
+        else if (memory.load(std::memory_order_relaxed) > options.memory)
+                reason = eBudgetMemory;
+        else if (std::chrono::steady_clock::now() >= options.deadline)
+                reason = eBudgetTime;
+
+        if (reason == eBudgetNone)
+                return true;
 
-        throw std::runtime_error("perceptual_complexity: unknown operand type");
+        // Only the first budget to run out is reported
+        Budget none = eBudgetNone;
+        exhausted.compare_exchange_strong(none, reason, std::memory_order_relaxed);
+        return false;
 }
 
-// Returns a constant factor if possible
-// NOTE: This is different from general factorization,
-// which is deffered to a later stage
-Operand additive_constant_factor_match(Operation *prop, const Operand &base, const Operand &target)
+SimplifyUsage simplification_budget::usage() const
 {
-        // NOTE: ONLY SUPPORTS MULTIPLICATIVE FACTORIZING
-        // exponentiation isnt commutative
-        assert(prop->id == op_mul->id);
+        SimplifyUsage usage;
+        usage.elapsed = std::chrono::steady_clock::now() - start;
+        usage.steps = std::min(steps.load(std::memory_order_relaxed), options.steps);
+        usage.memory = memory.load(std::memory_order_relaxed);
+        usage.exhausted = exhausted.load(std::memory_order_relaxed);
+        return usage;
+}
 
-        // We simply want to find a subexpression of target that equals base
-        lout << "Constant factoring between " << base.string() << " and " << target.string() << "\n";
-        if (!target.is_binary_grouping()) {
-                if (cmp(hash(base), hash(target)) == 0)
-                        return 1;
+// Nodes which are shared with other entries are counted for each entry
+static size_t footprint(const Operand &opd)
+{
+        return sizeof(Operand) + size(opd) * sizeof(BinaryGrouping);
+}
 
-                return {};
-        }
+void simplification_context::charge(size_t bytes_)
+{
+        bytes += bytes_;
+        if (budget)
+                budget->charge(bytes_);
+}
 
-        std::vector <Operand> items = unfold(prop, target.uo.as_binary_grouping());
-        for (Operand opd : items)
-                lout << "  $ " << opd.string() << "\n";
-
-        bool found = false;
-        for (auto it = items.begin(); it != items.end(); it++) {
-                if (cmp(base, *it)) {
-                        lout << "  common: " << it->string() << "\n";
-                        items.erase(it);
-                        found = true;
-                        break;
-                }
-        }
+simplification_context::cachelet &simplification_context::insert(const ExpressionHash &hash, const Operand &source, std::vector <Operand> results)
+{
+        size_t footprint = sizeof(cachelet) + detail::footprint(source);
+        for (const Operand &opd : results)
+                footprint += detail::footprint(opd);
 
-        if (!found) {
-                lout << "  no common factor\n";
-                return {};
-        }
+        charge(footprint);
 
-        lout << "Remaining items:\n";
-        for (Operand opd : items)
-                lout << "  $ " << opd.string() << "\n";
+        // Keep the load factor under a half
+        if (2 * (cache.size() + 1) > index.size()) {
+                index.assign(std::max <size_t> (16, 2 * index.size()), -1);
 
-        if (items.size() == 0)
-                return 1ll;
+                size_t mask = index.size() - 1;
+                for (size_t j = 0; j < cache.size(); j++) {
+                        size_t i = cache[j].hash.fingerprint & mask;
+                        while (index[i] != -1)
+                                i = (i + 1) & mask;
 
-        if (items.size() == 1)
-                return items[0];
+                        index[i] = j;
+                }
+        }
+
+        size_t mask = index.size() - 1;
+        size_t i = hash.fingerprint & mask;
+        while (index[i] != -1)
+                i = (i + 1) & mask;
 
-        lout << "Folded:" << fold(prop, items).string() << "\n";
-        return fold(prop, items);
+        index[i] = cache.size();
+        return cache.emplace_back(hash, source, std::move(results));
 }
 
-Operand multiplicative_constant_factor_match(Operation *prop, const Operand &base, const Operand &target, simplification_context &sctx)
+void simplification_context::append(const ExpressionHash &hash, const Operand &source, const Operand &result)
 {
-        // TODO: make a non commutative version of this
-        // which aggresivel checks for common base (or bases that
-        // can be factored out)
-        //  - if the bases are both integers, then factor if perfect powers of each other
-        //  - if the bases are both reals, then change base to e?
-        assert(prop->id == op_exp->id);
-
-        static auto base_of = [](const Operand &opd) -> std::pair <Operand, Operand> {
-                // Sanity check
-                if (opd.is_binary_grouping()) {
-                        BinaryGrouping bg = opd.uo.as_binary_grouping();
-                        if (bg.op && bg.op->id == op_exp->id)
-                                return { bg.opda, bg.opdb };
-                }
-
-                return { opd, 1ll };
-        };
+        const cachelet *entry = find(hash, source);
+        if (!entry) {
+                insert(hash, source, { result });
+                return;
+        }
 
-        auto [b1, e1] = base_of(base);
-        auto [b2, e2] = base_of(target);
+        // NOTE: Only entries of this scope are modified in place
+        bool local = !cache.empty() && entry >= &cache.front() && entry <= &cache.back();
+        if (!local)
+                entry = &insert(hash, source, entry->results);
 
-        lout << "Constant (multiplicative) factoring between " << base.string() << " and " << target.string() << "\n";
-        lout << "  base 1: " << b1.string() << ", exponent: " << e1.string() << "\n";
-        lout << "  base 2: " << b2.string() << ", exponent: " << e2.string() << "\n";
+        const_cast <cachelet *> (entry)->results.push_back(result);
+        charge(detail::footprint(result));
+}
 
-        if (!cmp(b1, b2))
-                return {};
+void simplification_context::settle(const ExpressionHash &hash, const Operand &source, const Operand &result)
+{
+        const cachelet *entry = find(hash, source);
+        bool local = entry && !cache.empty() && entry >= &cache.front() && entry <= &cache.back();
+        if (!local) {
+                insert(hash, source, { result });
+                return;
+        }
 
-        lout << "  same base!\n";
+        const_cast <cachelet *> (entry)->results = { result };
+        charge(detail::footprint(result));
+}
 
-        // TODO: add operators for this kind of semantics...
-        // Operand e = e1 + e2;
-        Operand exp;
-        if (e1.is_one()) {
-                exp = e2;
-        } else if (e1.is_constant()) {
-                if (e1.type == eInteger && e2.type == eInteger) {
-                        if (e2.i % e1.i == 0)
-                                exp = e2.i / e1.i;
-                }
-        } // TODO: if the exponents are themself additive factors...
+void simplification_context::merge(simplification_context &&scope)
+{
+        assert(scope.parent == this);
 
-        if (exp.is_blank()) {
-                lout << "  no exponent match\n";
-                return {};
+        for (cachelet &entry : scope.cache) {
+                const cachelet *existing = find(entry.hash, entry.source);
+                bool local = existing && !cache.empty() && existing >= &cache.front() && existing <= &cache.back();
+                if (local)
+                        const_cast <cachelet *> (existing)->results = std::move(entry.results);
+                else
+                        insert(entry.hash, entry.source, std::move(entry.results));
         }
 
-        lout << "  exponent match: " << exp.string() << "\n";
-        
-        // TODO: simplify exponent
-        return simplify(exp, sctx);
+        stats.hits += scope.stats.hits;
+        stats.misses += scope.stats.misses;
+        stats.probes += scope.stats.probes;
+        stats.longest_probe = std::max(stats.longest_probe, scope.stats.longest_probe);
+
+        scope.cache.clear();
+        scope.index.clear();
 }
 
-Operand constant_factor_match(Operation *prop, const Operand &base, const Operand &target, simplification_context &sctx)
+// TODO: different header...
+// Perceptual complexity score as a heuristic for simplifying and factoring expressions
+int64_t perceptual_complexity(const Operand &opd)
 {
-        if (prop->id == op_mul->id)
-                return additive_constant_factor_match(prop, base, target);
-        else if (prop->id == op_exp->id)
-                return multiplicative_constant_factor_match(prop, base, target, sctx);
+        if (opd.is_blank())
+                throw std::runtime_error("perceptual_complexity: unknown operand type");
 
-        warning("constant_factor_match", "unknown operation");
-        return {};
+        // NOTE: Cached in the nodes (see detail::seal)
+        return complexity(opd);
 }
 
 inline Operation *promote(Operation *op)
@@ -430,7 +436,7 @@ inline Operation *promote(Operation *op)
         return op;
 }
 
-inline Operand identity(Operation *op)
+Operand identity(Operation *op)
 {
         assert(op->classifications & eOperationCommutative);
 
@@ -443,197 +449,252 @@ inline Operand identity(Operation *op)
         return {};
 }
 
-// TODO: Assumes the parent operation was commutative, but does not check for it
-std::vector <Operand> simplification_gather(Operation *focus, const std::vector <Operand> &unordered_items, simplification_context &sctx)
+// Splits an item into a constant coefficient and a base with respect to the
+// promoted operation, e.g. 3*x*y into (3, x*y) and y^2 into (2, y)
+static std::pair <Operand, Operand> split(Operation *focus, const Operand &opd)
 {
-        // Sanity check for later assumptions
-        assert(unordered_items.size() > 0);
-
-        //TODO: pass operation to give context to matching
-        // Gather common factors
-        // TODO: log instead of printing outright...
-        // e.g. define [...] cosntexpr operator<< (void) {} if disabled...
-
-        lout << "[!] Attempting to gather items from:\n";
-        for (Operand opd : unordered_items)
-                lout << "  $ " << opd.string() << "\n";
-
-        std::vector <ExpressionHash> hashes;
-        for (Operand opd : unordered_items)
-                hashes.push_back(hash(opd));
-
-        lout << "[!] Hashes:\n";
-        for (ExpressionHash hash : hashes) {
-                lout << "  $ ";
-                for (int64_t h : hash.linear)
-                        lout << h << " ";
-                lout << "\n";
-        }
-
-        // Sort items by hash length, in hopes that the
-        // shorter ones will lead to successful hashes
-        std::vector <Operand> items = unordered_items;
-        std::sort(items.begin(), items.end(),
-                [](const Operand &a, const Operand &b) {
-                        return hash(a).linear.size() < hash(b).linear.size();
+        if (focus->id == op_add->id && opd.is_product()) {
+                Operand coefficient = 1ll;
+                std::vector <Operand> rest;
+                for (const Operand &item : opd.as_nary_grouping().opds) {
+                        if (item.is_constant())
+                                coefficient = opftn(op_mul, coefficient, item);
+                        else
+                                rest.push_back(item);
                 }
-        );
 
-        // Recompute hashes
-        hashes.clear();
-        for (Operand opd : items)
-                hashes.push_back(hash(opd));
+                if (rest.empty())
+                        return { 1ll, opd };
 
-        lout << "[!] Sorted items:\n";
-        for (Operand opd : items)
-                lout << "  $ " << opd.string() << "\n";
+                if (rest.size() == 1)
+                        return { coefficient, rest[0] };
+
+                canonicalize(op_mul, rest);
+                return { coefficient, { new_ <NaryGrouping> (op_mul, rest), eNaryGrouping } };
+        }
 
-        // Search for pairwise matches
-        // TODO: matching should account for commutativity and inverse operations
+        if (focus->id == op_mul->id && opd.is_binary_grouping()) {
+                const BinaryGrouping &bg = opd.as_binary_grouping();
+                if (bg.op && bg.op->id == op_exp->id && bg.opdb.is_constant())
+                        return { bg.opdb, bg.opda };
+        }
 
-        // TODO: first pass gathering; combine hashes that are identical
-        // (either by commutativity) or inverses...
+        return { 1ll, opd };
+}
 
-        // NOTE: index, factor
-        std::unordered_map <int32_t, Operand> gathered;
+// TODO: Assumes the parent operation was commutative, but does not check for it
+// Combines items with the same base, e.g. 2x + 3x into 5x or y^3 * y^2 into y^5;
+// each item is split once and grouped by the fingerprint of its base, so this
+// takes linear time in expectation
+std::vector <Operand> simplification_gather(Operation *focus, const std::vector <Operand> &items)
+{
+        // Sanity check for later assumptions
+        assert(items.size() > 0);
 
-        std::vector <bool> ticked(items.size(), false);
+        FERMAT_LOG("[!] Attempting to gather items from:\n");
+        for (Operand opd : items)
+                FERMAT_LOG("  $ " << opd.string() << "\n");
 
-        // TODO: currently doesnt combine 2x + 3x or y^3 * y^2
-        // Need to find pairs that are identical or inverses -- easy for multiplication,
-        // harder for addition -- specialize this function for these
-        lout << "Checking for matches, focus = " << focus->lexicon << "\n";
-        for (size_t i = 0; i < hashes.size(); i++) {
-                if (!ticked[i]) {
-                        gathered[i] = 1;
-                        ticked[i] = true;
-                } else {
-                        gathered[i] = {};
-                        continue;
-                }
+        struct group {
+                Operand base;
+                Operand coefficient;
+        };
 
-                for (size_t j = i + 1; j < hashes.size(); j++) {
-                        Operand factor = constant_factor_match(promote(focus), items[i], items[j], sctx);
-                        if (factor.is_blank())
-                                continue;
+        // Groups in order of appearance, and their indices by fingerprint
+        std::vector <group> groups;
+        std::unordered_map <uint64_t, std::vector <size_t>> buckets;
+        buckets.reserve(items.size());
 
-                        lout << "Factor: " << factor.string() << "\n";
-                        gathered[i] = opftn(op_add, gathered[i], factor);
-                        ticked[j] = true;
-                }
-        }
-        
-        // TODO: factor.cpp which contains factorization functions
-        // and uses a pairwise strategy like string substring matching
+        for (const Operand &opd : items) {
+                auto [coefficient, base] = split(focus, opd);
 
-        // TODO: return early if no matches were found at all
+                std::vector <size_t> &bucket = buckets[fingerprint(base)];
+                auto it = std::find_if(bucket.begin(), bucket.end(),
+                        [&](size_t i) { return cmp(groups[i].base, base); });
 
-        lout << "Gathered map:\n";
-        for (auto [i, factor] : gathered)
-                lout << "  $ " << i << " -> " << factor.string() << "\n";
+                if (it == bucket.end()) {
+                        bucket.push_back(groups.size());
+                        groups.push_back({ base, coefficient });
+                } else {
+                        Operand &combined = groups[*it].coefficient;
+                        combined = opftn(op_add, combined, coefficient);
+                }
+        }
 
         Operation *op = promote(focus);
 
         std::vector <Operand> gathered_items;
-        for (auto [i, factor] : gathered) {
-                if (factor.is_blank() || factor.is_zero())
+        for (const group &g : groups) {
+                if (g.coefficient.is_zero())
                         continue;
 
-                lout << "Combining " << items[i].string() << " with factor " << factor.string() << "\n";
-                lout << "\tfactor is one? " << factor.is_one() << ", zero? " << factor.is_zero() << "\n";
-
-                // TODO: comparison operations...
-                if (!factor.is_one()) {
-                        // TODO: fold if promotion is commutative
-                        // to reduce the number of operations
-                        Operand opd = items[i];
+                FERMAT_LOG("Combining " << g.base.string() << " with factor " << g.coefficient.string() << "\n");
+                if (g.coefficient.is_one()) {
+                        gathered_items.push_back(g.base);
+                } else if (op->classifications & eOperationCommutative) {
+                        gathered_items.push_back(fold(op, { g.coefficient, g.base }));
+                } else {
                         gathered_items.push_back(Operand {
-                                new_ <BinaryGrouping> (op, opd, factor),
+                                new_ <BinaryGrouping> (op, g.base, g.coefficient),
                                 eBinaryGrouping
                         });
-                } else {
-                        gathered_items.push_back(items[i]);
                 }
         }
 
-        lout << "[!] Gathered items:\n";
+        FERMAT_LOG("[!] Gathered items:\n");
         for (Operand opd : gathered_items)
-                lout << "  $ " << opd.string() << "\n";
+                FERMAT_LOG("  $ " << opd.string() << "\n");
 
-        // TODO: if empty, then return the identity element for the operation
         if (gathered_items.empty())
                 gathered_items.push_back(identity(focus));
 
         return gathered_items;
 }
 
-Operand simplification_fold(Operation *focus, const BinaryGrouping &bg, simplification_context &sctx)
+bool is_identity(Operation *op, const Operand &opd)
+{
+        if (op->id == op_add->id)
+                return opd.is_zero();
+        if (op->id == op_mul->id)
+                return opd.is_one();
+
+        return false;
+}
+
+// NOTE: The last operand is never forked, so
+// that this thread has work in the meantime
+std::vector <Operand> simplify_each(const std::vector <Operand> &opds, simplification_context &sctx)
+{
+        std::vector <Operand> results(opds.size());
+        std::vector <bool> forked(opds.size(), false);
+
+        if (sctx.pool && opds.size() > 1) {
+                TaskGroup group(*sctx.pool);
+                for (size_t i = 0; i + 1 < opds.size(); i++) {
+                        if (size(opds[i]) < sctx.fork_threshold)
+                                continue;
+
+                        forked[i] = true;
+                        group.fork([&, i, branch = sctx.branch()]() mutable {
+                                results[i] = simplify(opds[i], branch);
+                        });
+                }
+
+                for (size_t i = 0; i < opds.size(); i++) {
+                        if (!forked[i])
+                                results[i] = simplify(opds[i], sctx);
+                }
+
+                group.join();
+                return results;
+        }
+
+        for (size_t i = 0; i < opds.size(); i++)
+                results[i] = simplify(opds[i], sctx);
+
+        return results;
+}
+
+// Simplifies the (flat) operands of a commutative operation,
+// and combines them into a single grouping
+Operand simplification_fold(Operation *focus, const std::vector <Operand> &items, simplification_context &sctx)
 {
         assert(focus->classifications & eOperationCommutative);
 
-        std::vector <Operand> items = unfold(focus, bg);
-        lout << "Unfolded items:\n";
+        FERMAT_LOG("Folding items:\n");
         for (Operand opd : items)
-                lout << "  $ " << opd.string() << "\n";
+                FERMAT_LOG("  $ " << opd.string() << "\n");
+
+        // Like terms are combined in a single pass, before gathering
+        std::vector <Operand> combined = items;
+        simplification_polynomial(focus, combined, false);
 
         std::vector <Operand> constants;
         std::vector <Operand> unresolved;
 
-        for (const Operand &opd : items) {
+        for (const Operand &opd : combined) {
                 if (is_constant(opd))
                         constants.push_back(opd);
                 else
                         unresolved.push_back(opd);
         }
 
-        // Process unresolved in case it simplifies to a constant
-        Operand unresolved_folded;
-        if (unresolved.size() == 1) {
-                lout << "single unresolved item: " << unresolved[0].string() << "\n";
-                unresolved_folded = simplify(unresolved[0], sctx);
-        } else if (unresolved.size() > 0) {
-                // TODO: refactor to factor_compress...
-                unresolved = simplification_gather(focus, unresolved, sctx);
-                lout << "Simplification gather result:\n";
-                for (Operand opd : unresolved)
-                        lout << "  $ " << opd.string() << "\n";
-
-                // TODO: check if the result is a constant...
-                // if (unresolved.size() > 0)
-                unresolved_folded = fold(focus, unresolved);
-                if (is_constant(unresolved_folded)) {
-                        constants.push_back(unresolved_folded);
-                        unresolved_folded = {};
+        // Gather before simplifying, while the inverses
+        // are still explicit (e.g. y^-1 rather than 1/y)
+        if (unresolved.size() > 1)
+                unresolved = simplification_gather(focus, unresolved);
+
+        // Simplify the items, and keep the result flat
+        std::vector <Operand> simplified;
+
+        auto partition = [&](const Operand &opd) {
+                if (opd.is_constant())
+                        constants.push_back(opd);
+                else
+                        simplified.push_back(opd);
+        };
+
+        for (const Operand &opd : simplify_each(unresolved, sctx)) {
+                if (opd.is_nary_grouping() && opd.as_nary_grouping().op->id == focus->id) {
+                        for (const Operand &nested : opd.as_nary_grouping().opds)
+                                partition(nested);
+                } else {
+                        partition(opd);
                 }
+        }
+
+        // The simplified polynomial items are in normal form already,
+        // so combining them only takes as long as their terms; unless
+        // the budget ran out, in which case they are kept as they are
+        bool expired = sctx.budget && sctx.budget->expired();
+        if (!expired)
+                simplification_polynomial(focus, simplified);
 
-                lout << "Net unresolved folded: " << unresolved_folded.string() << "\n";
+        unresolved.clear();
+        for (const Operand &opd : simplified) {
+                if (opd.is_constant())
+                        constants.push_back(opd);
+                else
+                        unresolved.push_back(opd);
         }
 
-        Operand constant;
-        if (constants.size() > 0) {
-                constant = simplify(constants[0], sctx);
-                assert(constant.is_constant());
+        Operand constant = identity(focus);
+        for (const Operand &opd : constants) {
+                // NOTE: Constant subexpressions are left as they
+                // are if the budget runs out before they are folded
+                Operand c = simplify(opd, sctx);
+                if (!c.is_constant()) {
+                        assert(sctx.budget && sctx.budget->expired());
+                        unresolved.push_back(c);
+                        continue;
+                }
 
-                for (int i = 1; i < constants.size(); ++i) {
-                        Operand opd = simplify(constants[i], sctx);
-                        assert(opd.is_constant());
+                constant = opftn(focus, constant, c);
+        }
 
-                        constant = opftn(focus, constant, opd);
+        if (focus->id == op_mul->id && constant.is_zero())
+                return constant;
+
+        // Simplified items may gather further, and in turn simplify again
+        if (unresolved.size() > 1) {
+                std::vector <Operand> gathered = simplification_gather(focus, unresolved);
+                if (gathered.size() < unresolved.size()) {
+                        FERMAT_LOG("Gathered " << unresolved.size() << " items into " << gathered.size() << "\n");
+                        gathered.push_back(constant);
+                        return simplification_fold(focus, gathered, sctx);
                 }
         }
 
-        // TODO: hash each element and see if we can combine terms...
-        // or factor common terms (thats maximizes some score...)
+        if (unresolved.empty() || !is_identity(focus, constant))
+                unresolved.push_back(constant);
 
-        assert(!constant.is_blank() || !unresolved_folded.is_blank());
-        if (constant.is_blank())
-                return unresolved_folded;
-        if (unresolved_folded.is_blank())
-                return constant;
+        if (unresolved.size() == 1)
+                return unresolved[0];
 
+        canonicalize(focus, unresolved);
         return Operand {
-                new_ <BinaryGrouping> (focus, constant, unresolved_folded),
-                eBinaryGrouping
+                new_ <NaryGrouping> (focus, unresolved),
+                eNaryGrouping
         };
 }
 
@@ -647,50 +708,12 @@ Operand simplification_aggressive(const BinaryGrouping &bg, simplification_conte
         assert(!is_constant(bg.opda) || !is_constant(bg.opdb) || !bg.degenerate());
 
         Operand out = { new_ <BinaryGrouping> (bg), eBinaryGrouping };
-                
-        const Operand &opda = bg.opda;
-        const Operand &opdb = bg.opdb;
-        if (bg.op->classifications & eOperationCommutative) {
-                if (bg.op->id == op_add->id) {
-                        if (opda.is_zero())
-                                out = opdb;
-                        else if (opdb.is_zero())
-                                out = opda;
-                } else if (bg.op->id == op_mul->id) {
-                        if (opda.is_one())
-                                out = opdb;
-                        else if (opda.is_zero())
-                                out = 0;
-                        else if (opdb.is_one())
-                                out = opda;
-                        else if (opdb.is_zero())
-                                out = 0;
-                }
-        } else {
-                if (bg.op->id == op_exp->id) {
-                        if (opda.is_zero()) {
-                                out = 0;
-                        } else if (opda.is_one()) {
-                                out = 1;
-                        } if (opdb.is_zero()) {
-                                out = 1;
-                        } else if (opdb.is_one()) {
-                                out = opda;
-                        } else if (opdb.is_integer()) {
-                                if (opdb.i < 0)
-                                        out = 1/(opda^(-opdb.i));
-                        } else if (opdb.is_real()) {
-                                if (opdb.r == 0.5) {}
-                                        // TODO: sqrt function
-                                else if (opdb.r < 0)
-                                        out = 1/(opda^(-opdb.r));
-                        }
-                }
-        }
+        if (std::optional <Operand> rewritten = simplification_rules().rewrite(out))
+                out = *rewritten;
 
         // Simplify the operands if still possible
         if (out.is_binary_grouping()) {
-                BinaryGrouping bg = out.uo.as_binary_grouping();
+                BinaryGrouping bg = out.as_binary_grouping();
                 if (bg.opda.is_binary_grouping())
                         bg.opda = simplify(bg.opda, sctx);
                 if (bg.opdb.is_binary_grouping())
@@ -712,31 +735,32 @@ Operand simplify(const BinaryGrouping &bg, detail::simplification_context &sctx)
         if (bg.degenerate())
                 return simplify(bg.opda, sctx);
 
-        lout << "\n--> Simplifying: " << bg.string() << "\n";
-        lout << "  sctx: " << sctx.cache.size() << "\n";
+        FERMAT_LOG("\n--> Simplifying: " << bg.string() << "\n");
+        FERMAT_LOG("  sctx: " << sctx.cache.size() << "\n");
         Operation *focus = bg.op;
-        lout << "Original focus: " << focus->lexicon << "\n";
+        FERMAT_LOG("Original focus: " << focus->lexicon << "\n");
 
         // TODO: exit if expression is already simplified in the context (by
         // hash...)
-        detail::ExpressionHash hash = detail::hash(bg);
-        lout << "  $ expr hash = " << hash.string() << "\n";
-        lout << "[*] current cache context" << "\n";
-        lout << sctx.string() << "\n";
-
-        if (sctx.find(hash) != -1) {
-                int64_t index = sctx.find(hash);
-                const auto &results = sctx.cache[index].second;
+        // Reorderings of the same expression share their cache entry
+        Operand source = detail::canonical({ new_ <BinaryGrouping> (bg), eBinaryGrouping });
+        detail::ExpressionHash hash = detail::hash(source);
+        FERMAT_LOG("  $ expr hash = " << hash.string() << "\n");
+        FERMAT_LOG("[*] current cache context" << "\n");
+        FERMAT_LOG(sctx.string() << "\n");
+
+        if (const auto *entry = sctx.find(hash, source)) {
+                const auto &results = entry->results;
                 for (const Operand &opd : results) {
-                        lout << "compare: " << opd.string() << "\n";
+                        FERMAT_LOG("compare: " << opd.string() << "\n");
                         // TODO: pick lowest score...
-                        if (cmp(hash, detail::hash(opd)) == 0) {
-                                lout << "Already simplified: " << opd.string() << "\n";
+                        if (detail::cmp(opd, source)) {
+                                FERMAT_LOG("Already simplified: " << opd.string() << "\n");
                                 return opd;
                         }
                 }
 
-                lout << "Already simplified: " << results[0].string() << "\n";
+                FERMAT_LOG("Already simplified: " << results[0].string() << "\n");
                 return results[0];
         }
 
@@ -744,150 +768,214 @@ Operand simplify(const BinaryGrouping &bg, detail::simplification_context &sctx)
         for (auto pr : commutative_inverses) {
                 if (pr.second.id == bg.op->id) {
                         focus = &g_operations[pr.first];
-                        lout << "Found inverse: " << focus->lexicon << "\n";
+                        FERMAT_LOG("Found inverse: " << focus->lexicon << "\n");
                         break;
                 }
         }
 
-        // Initial hashes
-        detail::ExpressionHash ihasha = detail::hash(bg.opda);
-        detail::ExpressionHash ihashb = detail::hash(bg.opdb);
-
-        BinaryGrouping out;
+        // Sums and products (and their inverses) are
+        // simplified as flat groupings
         if (focus->classifications & eOperationCommutative) {
-                // Perform fold simplification first
-                lout << "Simplifying with operation: " << focus->lexicon << "\n";
-                Operand simplified = detail::simplification_fold(focus, bg, sctx);
-                lout << "Fold simplification:\n" << simplified.pretty() << "\n";
-
-                // If no longer a binary grouping, then return
-                if (!simplified.is_binary_grouping()) {
-                        lout << "No longer a binary grouping" << "\n";
-                        // Check what other strategies we have
-                        return simplify(simplified, sctx);
-                }
-                
-                // Check for degeneracy again
-                // TODO: why is this allowed in the first plane?
-                BinaryGrouping bgopt = simplified.uo.as_binary_grouping();
-                if (bgopt.degenerate()) {
-                        lout << "Degenerate simplification: " << bgopt.opda.string() << "\n";
-                        return simplify(bgopt.opda, sctx);
-                }
-
-                // Other wise
-                lout << "Simplifying first branch: " << bgopt.opda.string() << " for " << bgopt.string() << "\n";
-                lout << "  original context: " << sctx.cache.size() << " with expr "  << bg.string() << "\n";
-                Operand a = simplify(bgopt.opda, sctx);
-
-                lout << "Simplifying second branch: " << bgopt.opdb.string() << " for " << bgopt.string() << "\n";
-                lout << "  original context: " << sctx.cache.size() << " with expr "  << bg.string() << "\n";
-                Operand b = simplify(bgopt.opdb, sctx);
+                FERMAT_LOG("Simplifying with operation: " << focus->lexicon << "\n");
+                std::vector <Operand> items = unfold(focus, bg);
+                Operand simplified = detail::simplification_fold(focus, items, sctx);
+                FERMAT_LOG("Fold simplification:\n" << simplified.pretty() << "\n");
 
-                // TODO: otherwise fallback to specialized simplification rules
-
-                // TODO: top down simplification or bottom up simplification?
-                // bottom down is simpler/faster, but top down is more powerful
-                // and we may be able to manipulate the tree in a more meaningful
-                // way
-                
-                // TODO: negative exponents should be transfered to the denominator
+                sctx.settle(hash, source, simplified);
+                return simplified;
+        }
 
-                // TODO: hash each branch and compare to see if we can combine or cancel terms
-                // What is the hash function?
+        // Initial hashes
+        detail::ExpressionHash ihasha = detail::hash(bg.opda);
+        detail::ExpressionHash ihashb = detail::hash(bg.opdb);
 
-                out = bgopt;
-                out.opda = a;
-                out.opdb = b;
+        // Simplify the operands
+        std::vector <Operand> opds = detail::simplify_each({ bg.opda, bg.opdb }, sctx);
 
-                lout << "[*]  post branch simplification: " << out.string() << "\n";
-        } else {
-                // Simplify the operands
-                Operand a = simplify(bg.opda, sctx);
-                Operand b = simplify(bg.opdb, sctx);
+        BinaryGrouping out = bg;
+        out.opda = opds[0];
+        out.opdb = opds[1];
 
-                out = bg;
-                out.opda = a;
-                out.opdb = b;
-                
-                lout << "[*]  regular branch-wise simplification: " << out.string() << "\n";
-        }
+        FERMAT_LOG("[*]  regular branch-wise simplification: " << out.string() << "\n");
 
         // If both are constant, then combine them
         if (out.opda.is_constant() && out.opdb.is_constant())
                 return opftn(out.op, out.opda, out.opdb);
 
-        lout << "[I]  perparing to aggressively simplify: " << out.string() << "\n";
-        int64_t index = sctx.find(hash);
-        if (index == -1) {
-                sctx.cache.push_back({ hash, {{ new_ <BinaryGrouping> (out), eBinaryGrouping }}});
-        } else {
-                auto &results = sctx.cache[index];
-                results.second.push_back({ new_ <BinaryGrouping> (out), eBinaryGrouping });
-        }
+        // NOTE: Placeholder while the source is in progress, which ends
+        // cycles of rewrites; it is replaced by the final result (see
+        // settle), so that later lookups never see it
+        FERMAT_LOG("[I]  perparing to aggressively simplify: " << out.string() << "\n");
+        sctx.append(hash, source, { new_ <BinaryGrouping> (out), eBinaryGrouping });
 
         Operand result = detail::simplification_aggressive(out, sctx);
-        lout << "[*]  aggressive simplification: " << result.string() << " for " << bg.string() << "\n";
+        FERMAT_LOG("[*]  aggressive simplification: " << result.string() << " for " << bg.string() << "\n");
         if (result.is_binary_grouping()) {
-                const BinaryGrouping &nbg = result.uo.as_binary_grouping();
+                const BinaryGrouping &nbg = result.as_binary_grouping();
 
                 detail::ExpressionHash fhasha = detail::hash(nbg.opda);
                 detail::ExpressionHash fhashb = detail::hash(nbg.opdb);
 
-                lout << "starting expression: " << bg.string() << " vs " << result.string() << "\n";
+                FERMAT_LOG("starting expression: " << bg.string() << " vs " << result.string() << "\n");
 
                 // NOTE: loop until no more simplifications can be made
                 // TODO: cycle check (e.g. x^-1 and 1/x) -- choose one with
                 // lower perceptual_complexity value
-                if (cmp(fhasha, ihasha) + cmp(fhashb, ihashb) != 0) {
-                        lout << "New tree, re-simplifying: " << result.string() << "\n";
+                if (fhasha != ihasha || fhashb != ihashb) {
+                        FERMAT_LOG("New tree, re-simplifying: " << result.string() << "\n");
 
                         // Before recursing, check if we have already seen this
-                        detail::ExpressionHash hash = detail::hash(nbg);
+                        detail::ExpressionHash rhash = detail::hash(result);
 
-                        // auto it = sctx.cache.find(hash);
-                        int64_t index = sctx.find(hash);
-                        if (index  != -1) {
-                                const auto &results = sctx.cache[index].second;
+                        if (const auto *entry = sctx.find(rhash, result)) {
+                                const auto &results = entry->results;
                                 for (auto &res : results) {
-                                        lout << "Comparing: " << res.string() << " and " << result.string() << "\n";
+                                        FERMAT_LOG("Comparing: " << res.string() << " and " << result.string() << "\n");
                                         if (detail::cmp(res, result)) {
-                                                lout << "Already seen this result\n";
+                                                FERMAT_LOG("Already seen this result\n");
                                                 // TODO: return smallest perceptual_complexity
                                                 return result;
                                         }
                                 }
                         } else {
-                                sctx.cache.push_back({ hash, {{ new_ <BinaryGrouping> (nbg), eBinaryGrouping }}});
+                                sctx.insert(rhash, result, { result });
                         }
 
-                        detail::simplification_context sctx_copy = sctx;
-
-                        // auto &results = sctx_copy.cache[index].second;
-                        // results.push_back(result);
+                        // NOTE: Entries found while re-simplifying are
+                        // only kept for the rest of this call
+                        detail::simplification_context scope = sctx.scope();
+                        Operand simplified = simplify(result.as_binary_grouping(), scope);
 
-                        return simplify(result.uo.as_binary_grouping(), sctx_copy);
+                        sctx.settle(rhash, result, simplified);
+                        sctx.settle(hash, source, simplified);
+                        return simplified;
                 }
         }
 
+        sctx.settle(hash, source, result);
         return result;
 }
 
+Operand simplify(const NaryGrouping &ng, detail::simplification_context &sctx)
+{
+        FERMAT_LOG("\n--> Simplifying: " << ng.string() << "\n");
+
+        Operand source = detail::canonical({ new_ <NaryGrouping> (ng), eNaryGrouping });
+        detail::ExpressionHash hash = detail::hash(source);
+        if (const auto *entry = sctx.find(hash, source)) {
+                FERMAT_LOG("Already simplified: " << entry->results[0].string() << "\n");
+                return entry->results[0];
+        }
+
+        // Inverse operations (e.g. division in a product) are unfolded too
+        std::vector <Operand> items;
+        for (const Operand &opd : ng.opds) {
+                std::vector <Operand> unfolded = unfold(ng.op, opd);
+                items.insert(items.end(), unfolded.begin(), unfolded.end());
+        }
+
+        Operand simplified = detail::simplification_fold(ng.op, items, sctx);
+
+        sctx.settle(hash, source, simplified);
+        return simplified;
+}
+
 Operand simplify(const Operand &opd, detail::simplification_context &sctx)
 {
         // TODO: this function is short, combine with one above?
         if (opd.is_constant() || opd.is_blank())
                 return opd;
 
-        UnresolvedOperand uo = opd.uo;
-        switch (uo.type) {
-        case eVariable:
-                return opd;
+        // NOTE: Free if the expression is already canonical
+        Operand canon = detail::canonical(opd);
+        if (canon.is_variable())
+                return canon;
+
+        if (sctx.incremental) {
+                if (std::optional <Operand> kept = sctx.incremental->find(canon))
+                        return *kept;
+        }
+
+        if (sctx.memo) {
+                if (std::optional <Operand> memoized = sctx.memo->find(canon))
+                        return *memoized;
+        }
+
+        if (sctx.persistent) {
+                if (std::optional <Operand> stored = sctx.persistent->find(canon)) {
+                        if (sctx.memo)
+                                sctx.memo->insert(canon, *stored);
+
+                        return *stored;
+                }
+        }
+
+        // Once the budget runs out, the rest is kept as it is
+        if (sctx.budget && !sctx.budget->step())
+                return canon;
+
+        Operand result;
+        switch (canon.kind()) {
         case eBinaryGrouping:
-                return simplify(uo.as_binary_grouping(), sctx);
+                result = simplify(canon.as_binary_grouping(), sctx);
+                break;
+        case eNaryGrouping:
+                result = simplify(canon.as_nary_grouping(), sctx);
+                break;
+        default:
+                throw std::runtime_error("simplify: unsupported operand type, opd=<" + opd.string() + ">");
+        }
+
+        // Results which were cut short are incomplete, and may even be
+        // more complex than the source, so they are not kept either
+        if (sctx.budget && sctx.budget->expired()) {
+                if (detail::perceptual_complexity(canon) < detail::perceptual_complexity(result))
+                        return canon;
+
+                return result;
+        }
+
+        if (sctx.incremental)
+                sctx.incremental->insert(canon, result);
+
+        if (sctx.memo)
+                sctx.memo->insert(canon, result);
+
+        return result;
+}
+
+Operand simplify(const Operand &opd, detail::simplification_context &sctx, const SimplifyOptions &options, SimplifyUsage *usage)
+{
+        detail::simplification_budget budget(options);
+
+        detail::simplification_budget *previous = std::exchange(sctx.budget, &budget);
+
+        // NOTE: Entries are made in a scope, and only kept if the budget
+        // lasts, since those of a cut short call may be partial results
+        detail::simplification_context scope = sctx.scope();
+
+        Operand result;
+        try {
+                result = simplify(opd, scope);
+        } catch (...) {
+                sctx.budget = previous;
+                throw;
         }
 
-        throw std::runtime_error("simplify: unsupported operand type, opd=<" + opd.string() + ">");
+        sctx.budget = previous;
+        if (!budget.expired())
+                sctx.merge(std::move(scope));
+
+        if (usage)
+                *usage = budget.usage();
+
+        return result;
+}
+
+Operand simplify(const Operand &opd, const SimplifyOptions &options, SimplifyUsage *usage)
+{
+        detail::simplification_context sctx;
+        return simplify(opd, sctx, options, usage);
 }
 
 }
@@ -1,55 +1,201 @@
 #pragma once
 
+// Standard headers
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <map>
+
 // Local headers
 #include "operand.hpp"
 
-#include <map>
-
 namespace fermat {
 
+struct IncrementalSimplifier;
+struct PersistentCache;
+struct SimplificationMemo;
+struct ThreadPool;
+
+// Bounds on a call to simplify, each unbounded by default; steps are
+// subexpressions simplified, and memory is the approximate footprint of
+// the caches, counted as in SimplificationMemo. Budgets are checked
+// before each step, so the steps in progress still finish (without
+// recursing further), which overruns the deadline somewhat
+struct SimplifyOptions {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        size_t steps = std::numeric_limits <size_t> ::max();
+        size_t memory = std::numeric_limits <size_t> ::max();
+};
+
+enum Budget {
+        eBudgetNone,
+        eBudgetTime,
+        eBudgetSteps,
+        eBudgetMemory,
+};
+
+// How much of each budget a call used, and which one ran out first, if any
+struct SimplifyUsage {
+        std::chrono::nanoseconds elapsed { 0 };
+        size_t steps = 0;
+        size_t memory = 0;
+        Budget exhausted = eBudgetNone;
+};
+
 namespace detail {
 
+// Shared by the branches of a context, which may run on other threads;
+// once a budget runs out it stays exhausted for the rest of the call
+struct simplification_budget {
+        SimplifyOptions options;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::atomic <size_t> steps = 0;
+        std::atomic <size_t> memory = 0;
+        std::atomic <Budget> exhausted = eBudgetNone;
+
+        simplification_budget(const SimplifyOptions &options_) : options { options_ } {}
+
+        // Counts a step; returns whether it is still within the budget
+        bool step();
+
+        void charge(size_t bytes) {
+                memory.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        bool expired() const {
+                return exhausted.load(std::memory_order_relaxed) != eBudgetNone;
+        }
+
+        SimplifyUsage usage() const;
+};
+
 // TODO: lower-case
+// Fingerprint of an expression along with its number of nodes and leaves;
+// equal expressions have equal hashes, but not necessarily the converse
 struct ExpressionHash {
-        std::vector <int64_t> linear;
-        // std::vector <int32_t> redirect;
+        uint64_t fingerprint = 0;
+        uint32_t size = 0;
 
-        std::string string() const {
-                std::string ret;
-
-                for (auto i : linear) {
-                        ret += std::to_string(i);
-                        if (i != linear.back())
-                                ret += " ";
-                }
+        bool operator==(const ExpressionHash &) const = default;
 
-                return "(" + ret + ")";
+        std::string string() const {
+                return "(" + std::to_string(fingerprint) + ", " + std::to_string(size) + ")";
         }
 };
 
-int64_t cmp(const ExpressionHash &, const ExpressionHash &);
-struct simplification_context {
-        // TODO: use to cache repeated expressions
-        using cachelet = std::pair <ExpressionHash, std::vector <Operand>>;
+ExpressionHash hash(const Operand &);
+ExpressionHash hash(const BinaryGrouping &);
+ExpressionHash hash(const NaryGrouping &);
 
+// Identity element of a commutative operation (e.g. 0 for sums)
+Operand identity(Operation *);
+bool is_identity(Operation *, const Operand &);
+
+// Heuristic for how simple an expression reads; lower is simpler
+int64_t perceptual_complexity(const Operand &);
+
+// Structural equality; for canonical expressions (see detail::canonical)
+// this is equality up to commutativity and associativity
+bool cmp(const Operand &, const Operand &);
+
+struct simplification_context {
+        // The source expression is kept to rule out collisions
+        struct cachelet {
+                ExpressionHash hash;
+                Operand source;
+                std::vector <Operand> results;
+        };
+
+        // Lookup counters, e.g. for profiling
+        struct statistics {
+                size_t hits = 0;
+                size_t misses = 0;
+                size_t probes = 0;
+                size_t longest_probe = 0;
+        };
+
+        // Entries in order of insertion
         std::vector <cachelet> cache;
 
-        int64_t find(const ExpressionHash &hash) const {
-                for (int64_t i = 0; i < cache.size(); ++i) {
-                        if (cmp(cache[i].first, hash) == 0) {
-                                return i;
-                        }
-                }
+        // Enclosing scope, whose entries are visible but never modified
+        // here (see scope); it must outlive this context
+        const simplification_context *parent = nullptr;
+
+        // Open addressing index into the cache, by fingerprint
+        std::vector <int32_t> index;
+
+        mutable statistics stats;
+
+        // Approximate footprint of the cache, in bytes
+        size_t bytes = 0;
+
+        // Shared between contexts if set, e.g. across calls
+        SimplificationMemo *memo = nullptr;
+
+        // Subtrees kept from previous calls, consulted first if set
+        IncrementalSimplifier *incremental = nullptr;
+
+        // Consulted after the memo, if set
+        const PersistentCache *persistent = nullptr;
+
+        // Subtrees of at least the threshold size (in nodes) are simplified
+        // on the pool, if set; the workers share results through the memo
+        ThreadPool *pool = nullptr;
+        uint32_t fork_threshold = 256;
 
-                return -1;
+        // Bounds the call, if set; see SimplifyOptions
+        simplification_budget *budget = nullptr;
+
+        // Context for a subtree simplified on another thread; shares
+        // the memo, but not the local cache nor the incremental state
+        simplification_context branch() const {
+                simplification_context sctx;
+                sctx.memo = memo;
+                sctx.persistent = persistent;
+                sctx.pool = pool;
+                sctx.fork_threshold = fork_threshold;
+                sctx.budget = budget;
+                return sctx;
+        }
+
+        // Context for re-simplifying on the same thread, in constant time;
+        // it sees the entries of this context, but its own are dropped with it
+        simplification_context scope() const {
+                simplification_context sctx = branch();
+                sctx.incremental = incremental;
+                sctx.parent = this;
+                return sctx;
         }
 
+        // Searches this scope, then the enclosing ones; returns null if
+        // there is no entry
+        const cachelet *find(const ExpressionHash &, const Operand &) const;
+
+        // Adds an entry to this scope, which shadows any of the enclosing ones
+        cachelet &insert(const ExpressionHash &, const Operand &, std::vector <Operand>);
+
+        // Adds a result to the entry of the source, or creates it; entries
+        // of enclosing scopes are copied into this one first
+        void append(const ExpressionHash &, const Operand &, const Operand &);
+
+        // Records the final result of the source in this scope, replacing
+        // any results (e.g. placeholders marking it as in progress)
+        void settle(const ExpressionHash &, const Operand &, const Operand &);
+
+        // Moves the entries of a scope of this context into this one,
+        // replacing those of the same sources
+        void merge(simplification_context &&);
+
+        // Accounts for memory held by the cache
+        void charge(size_t);
+
         std::string string() const {
                 std::string ret;
 
                 for (auto &i : cache) {
-                        ret += i.first.string() + " -> ";
-                        for (auto &j : i.second) {
+                        ret += i.hash.string() + " -> ";
+                        for (auto &j : i.results) {
                                 ret += j.string() + " ";
                         }
                         ret += "\n";
@@ -59,13 +205,25 @@ struct simplification_context {
         }
 };
 
+// Simplifies each of the operands, in parallel if the context has a pool
+std::vector <Operand> simplify_each(const std::vector <Operand> &, simplification_context &);
+
 }
 
 Operand simplify(const Operand &, detail::simplification_context &);
 Operand simplify(const BinaryGrouping &, detail::simplification_context &);
+Operand simplify(const NaryGrouping &, detail::simplification_context &);
+
+// Anytime simplification; once a budget runs out, subexpressions which are not
+// simplified yet are kept as they are, and the simplest of the expression and
+// its partially simplified form is returned. Partial results are not memoized
+Operand simplify(const Operand &, const SimplifyOptions &, SimplifyUsage * = nullptr);
+Operand simplify(const Operand &, detail::simplification_context &, const SimplifyOptions &, SimplifyUsage * = nullptr);
+
+// Flat grouping of the operands, with their constants folded into one
+Operand fold(Operation *, const std::vector <Operand> &);
 
 // TODO: is this needed?
 // std::vector <Operand> unfold(const BinaryGrouping &bg);
-// Operand fold(Operation *op, const std::vector <Operand> &opds);
 
 }
@@ -0,0 +1,79 @@
+// Standard headers
+#include <mutex>
+#include <stdexcept>
+
+// Local headers
+#include "symbol_table.hpp"
+
+namespace fermat {
+
+SymbolId SymbolTable::intern(std::string_view name)
+{
+        // Most names are already present
+        {
+                std::shared_lock lock(mutex);
+                auto it = ids.find(name);
+                if (it != ids.end())
+                        return it->second;
+        }
+
+        std::unique_lock lock(mutex);
+        auto [it, inserted] = ids.try_emplace(std::string(name), names.size());
+        if (inserted)
+                names.emplace_back(name);
+
+        return it->second;
+}
+
+const std::string &SymbolTable::name(SymbolId id) const
+{
+        std::shared_lock lock(mutex);
+        if (id >= names.size())
+                throw std::out_of_range("SymbolTable: unknown symbol " + std::to_string(id));
+
+        return names[id];
+}
+
+std::optional <SymbolId> SymbolTable::find(std::string_view name) const
+{
+        std::shared_lock lock(mutex);
+        auto it = ids.find(name);
+        if (it == ids.end())
+                return std::nullopt;
+
+        return it->second;
+}
+
+size_t SymbolTable::size() const
+{
+        std::shared_lock lock(mutex);
+        return names.size();
+}
+
+namespace detail {
+
+SymbolTable &global_symbols()
+{
+        // NOTE: Leaked, since nodes may outlive static destruction
+        static SymbolTable *table = new SymbolTable;
+        return *table;
+}
+
+}
+
+SymbolId symbol(std::string_view name)
+{
+        return detail::global_symbols().intern(name);
+}
+
+std::optional <SymbolId> find_symbol(std::string_view name)
+{
+        return detail::global_symbols().find(name);
+}
+
+const std::string &symbol_name(SymbolId id)
+{
+        return detail::global_symbols().name(id);
+}
+
+}
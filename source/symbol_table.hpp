@@ -0,0 +1,68 @@
+#pragma once
+
+// Standard headers
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace fermat {
+
+using SymbolId = uint32_t;
+
+// Interned variable names, so that variables are compared, hashed and
+// ordered by id; symbols are never removed, so ids (and their names)
+// stay valid for the lifetime of the program
+struct SymbolTable {
+        struct name_hash {
+                using is_transparent = void;
+
+                size_t operator()(std::string_view name) const {
+                        return std::hash <std::string_view> {} (name);
+                }
+        };
+
+        mutable std::shared_mutex mutex;
+
+        std::unordered_map <std::string, SymbolId, name_hash, std::equal_to <>> ids;
+
+        // NOTE: References into a deque survive insertions
+        std::deque <std::string> names;
+
+        SymbolId intern(std::string_view);
+        const std::string &name(SymbolId) const;
+
+        // Id of a name which is already interned, without interning it
+        std::optional <SymbolId> find(std::string_view) const;
+
+        size_t size() const;
+};
+
+namespace detail {
+
+SymbolTable &global_symbols();
+
+// Hash of a name which is stable across processes (FNV-1a)
+inline uint64_t digest(std::string_view name)
+{
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (unsigned char c : name) {
+                hash ^= c;
+                hash *= 0x100000001b3ull;
+        }
+
+        return hash;
+}
+
+}
+
+// Shorthands for the global table
+SymbolId symbol(std::string_view);
+std::optional <SymbolId> find_symbol(std::string_view);
+const std::string &symbol_name(SymbolId);
+
+}
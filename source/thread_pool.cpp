@@ -0,0 +1,145 @@
+// Standard headers
+#include <algorithm>
+#include <utility>
+
+// Local headers
+#include "thread_pool.hpp"
+
+namespace fermat {
+
+// Index of the queue of the calling thread, if it is a worker of the pool
+static thread_local const ThreadPool *current_pool = nullptr;
+static thread_local size_t current_queue = 0;
+
+ThreadPool::ThreadPool(size_t threads_) : threads { threads_ }
+{
+        if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+
+        queues.reset(new queue [threads + 1]);
+        for (size_t t = 0; t < threads; t++)
+                workers.emplace_back(&ThreadPool::work, this, t);
+}
+
+ThreadPool::~ThreadPool()
+{
+        {
+                std::lock_guard <std::mutex> lock(idle_mutex);
+                stopping = true;
+        }
+
+        idle.notify_all();
+        for (std::thread &worker : workers)
+                worker.join();
+}
+
+void ThreadPool::submit(task t)
+{
+        size_t index = (current_pool == this) ? current_queue : threads;
+
+        {
+                std::lock_guard <std::mutex> lock(queues[index].mutex);
+                queues[index].tasks.push_back(std::move(t));
+        }
+
+        queued.fetch_add(1);
+
+        // NOTE: Locked so that the notification is not lost
+        // between a worker checking for tasks and sleeping
+        { std::lock_guard <std::mutex> lock(idle_mutex); }
+        idle.notify_one();
+}
+
+bool ThreadPool::take(task &t)
+{
+        size_t count = threads + 1;
+        size_t own = (current_pool == this) ? current_queue : threads;
+
+        // Newest of our own first
+        {
+                std::lock_guard <std::mutex> lock(queues[own].mutex);
+                if (!queues[own].tasks.empty()) {
+                        t = std::move(queues[own].tasks.back());
+                        queues[own].tasks.pop_back();
+                        queued.fetch_sub(1);
+                        return true;
+                }
+        }
+
+        // Otherwise the oldest of another's
+        for (size_t k = 1; k < count; k++) {
+                queue &victim = queues[(own + k) % count];
+
+                std::lock_guard <std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                        t = std::move(victim.tasks.front());
+                        victim.tasks.pop_front();
+                        queued.fetch_sub(1);
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+void ThreadPool::work(size_t index)
+{
+        current_pool = this;
+        current_queue = index;
+
+        task t;
+        while (true) {
+                if (take(t)) {
+                        t();
+                        t = nullptr;
+                        continue;
+                }
+
+                std::unique_lock <std::mutex> lock(idle_mutex);
+                idle.wait(lock, [&]() { return stopping || queued.load() > 0; });
+                if (stopping && queued.load() == 0)
+                        return;
+        }
+}
+
+TaskGroup::~TaskGroup()
+{
+        wait();
+}
+
+void TaskGroup::fork(ThreadPool::task t)
+{
+        pending.fetch_add(1);
+        pool.submit([this, t = std::move(t)]() {
+                try {
+                        t();
+                } catch (...) {
+                        std::lock_guard <std::mutex> lock(mutex);
+                        if (!exception)
+                                exception = std::current_exception();
+                }
+
+                pending.fetch_sub(1);
+        });
+}
+
+void TaskGroup::join()
+{
+        wait();
+
+        if (exception)
+                std::rethrow_exception(std::exchange(exception, nullptr));
+}
+
+void TaskGroup::wait()
+{
+        while (pending.load() > 0) {
+                ThreadPool::task t;
+                if (pool.take(t))
+                        t();
+                else
+                        std::this_thread::yield();
+        }
+}
+
+}
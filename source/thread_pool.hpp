@@ -0,0 +1,86 @@
+#pragma once
+
+// Standard headers
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fermat {
+
+// Work-stealing pool for fork-join parallelism; workers take the newest of
+// their own tasks and steal the oldest of others', which are the largest
+// in recursive workloads (e.g. the top most subtrees of an expression)
+struct ThreadPool {
+        using task = std::function <void ()>;
+
+        struct queue {
+                std::mutex mutex;
+                std::deque <task> tasks;
+        };
+
+        // NOTE: Fixed before the workers start, which read it
+        size_t threads;
+
+        // One per worker, and a last one for threads outside the pool
+        std::unique_ptr <queue []> queues;
+
+        std::vector <std::thread> workers;
+
+        // Tasks which have been submitted but not yet taken
+        std::atomic <size_t> queued = 0;
+
+        // Idle workers sleep until there are tasks
+        std::mutex idle_mutex;
+        std::condition_variable idle;
+        bool stopping = false;
+
+        // Number of workers; defaults to the number of cores
+        ThreadPool(size_t = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        size_t size() const {
+                return threads;
+        }
+
+        void submit(task);
+
+        // Takes a task from the queue of the calling
+        // thread, or steals one from another queue
+        bool take(task &);
+private:
+        void work(size_t);
+};
+
+// Tasks forked from the same (calling) thread, which can be joined; the
+// joining thread runs pending tasks in the meantime, so that nested
+// groups do not deadlock the pool
+struct TaskGroup {
+        ThreadPool &pool;
+
+        std::atomic <size_t> pending = 0;
+
+        // First exception thrown by a task, rethrown on joining
+        std::mutex mutex;
+        std::exception_ptr exception;
+
+        TaskGroup(ThreadPool &pool_) : pool { pool_ } {}
+
+        // NOTE: Waits for the tasks, since they refer to the group
+        ~TaskGroup();
+
+        void fork(ThreadPool::task);
+        void join();
+private:
+        void wait();
+};
+
+}
@@ -0,0 +1,302 @@
+// Standard headers
+#include <bit>
+#include <cstring>
+#include <span>
+#include <utility>
+
+// Local headers
+#include "unique_table.hpp"
+
+namespace fermat {
+
+static UniqueTable::operand_key key_of(const Operand &opd)
+{
+        UniqueTable::operand_key key { opd.type, { 0, 0 } };
+
+        if (opd.type == eInteger) {
+                key.bits[0] = opd.i;
+        } else if (opd.type == eReal && opd.boxed) {
+                // NOTE: Only the significant bytes of a long double; the
+                // last word is tagged so it differs from inline doubles
+                Real r = opd.r();
+                std::memcpy(key.bits, &r, std::min <size_t> (sizeof(Real), 10));
+                key.bits[1] |= 1ull << 32;
+        } else if (opd.type == eReal) {
+                key.bits[0] = std::bit_cast <uint64_t> (opd.d);
+        } else if (opd.type == eRational) {
+                key.bits[0] = reinterpret_cast <uint64_t> (opd.node);
+        } else if (opd.type == eUnresolved) {
+                key.type = opd.kind();
+                key.bits[0] = reinterpret_cast <uint64_t> (opd.node);
+        }
+
+        return key;
+}
+
+static UniqueTable::grouping_key key_of(const BinaryGrouping &bg)
+{
+        return {
+                bg.op ? bg.op->id : -1,
+                key_of(bg.opda),
+                key_of(bg.opdb)
+        };
+}
+
+static UniqueTable::nary_key key_of(const NaryGrouping &ng)
+{
+        return { ng.op->id, ng.opds };
+}
+
+static SymbolId key_of(const Variable &var)
+{
+        return var.symbol;
+}
+
+static UniqueTable::rational_key key_of(const BoxedRational &br)
+{
+        return { &br.value };
+}
+
+bool UniqueTable::nary_key::operator==(const nary_key &other) const
+{
+        if (op != other.op || opds.size() != other.opds.size())
+                return false;
+
+        for (size_t i = 0; i < opds.size(); i++) {
+                if (key_of(opds[i]) != key_of(other.opds[i]))
+                        return false;
+        }
+
+        return true;
+}
+
+template <typename K>
+void UniqueTable::shard <K>::rehash(size_t capacity)
+{
+        std::vector <entry> old = std::exchange(entries, std::vector <entry> (capacity));
+        used = 0;
+
+        for (entry &e : old) {
+                if (!e.used || !e.node)
+                        continue;
+
+                size_t i = e.hash & (capacity - 1);
+                while (entries[i].used)
+                        i = (i + 1) & (capacity - 1);
+
+                entries[i] = std::move(e);
+                used++;
+        }
+}
+
+// Only succeeds if the node is not already being destroyed
+static bool try_retain(const Node *node)
+{
+        uint32_t count = node->references.load(std::memory_order_relaxed);
+        while (count) {
+                if (node->references.compare_exchange_weak(count, count + 1, std::memory_order_relaxed))
+                        return true;
+        }
+
+        return false;
+}
+
+// Returns the live node for the key, otherwise creates one
+template <typename T, typename K>
+static Uptr lookup(UniqueTable &table, UniqueTable::shard <K> &shard, size_t hash, const K &key, T &value)
+{
+        std::lock_guard <std::mutex> lock(shard.mutex);
+
+        // Keep the load factor under a half
+        if (2 * (shard.used + 1) > shard.entries.size()) {
+                size_t capacity = std::max <size_t> (16, shard.entries.size());
+                shard.rehash(capacity);
+
+                // Only grow if dropping dead entries was not enough
+                if (4 * (shard.used + 1) > capacity)
+                        shard.rehash(2 * capacity);
+        }
+
+        size_t mask = shard.entries.size() - 1;
+        size_t i = hash & mask;
+
+        // NOTE: Keys of destroyed nodes are never compared
+        auto *slot = &shard.entries[i];
+        while (slot->used) {
+                if (slot->hash == hash && slot->node && slot->key == key) {
+                        if (slot->node && try_retain(slot->node))
+                                return Uptr::adopt(slot->node);
+
+                        break;
+                }
+
+                i = (i + 1) & mask;
+                slot = &shard.entries[i];
+        }
+
+        T *node = detail::allocate_node <T> (table.resource, std::move(value));
+        node->table = &table;
+
+        // NOTE: The key may refer into the value, which has
+        // been moved, so it is taken from the node instead
+        if (!slot->used) {
+                slot->used = true;
+                shard.used++;
+        }
+
+        slot->hash = hash;
+        slot->key = key_of(*node);
+
+        // NOTE: A node which is being destroyed may still hold the slot,
+        // in which case it leaves the new entry alone
+        slot->node = node;
+        return Uptr { node };
+}
+
+// Nulls the entry of the node, if it still refers to it
+template <typename K>
+static void erase(UniqueTable::shard <K> &shard, size_t hash, const Node *node)
+{
+        std::lock_guard <std::mutex> lock(shard.mutex);
+        if (shard.entries.empty())
+                return;
+
+        size_t mask = shard.entries.size() - 1;
+        for (size_t i = hash & mask; shard.entries[i].used; i = (i + 1) & mask) {
+                if (shard.entries[i].node == node) {
+                        shard.entries[i].node = nullptr;
+                        return;
+                }
+        }
+}
+
+// NOTE: Variables are hashed by symbol, which is cheaper than their fingerprint
+static size_t hash_of(const Variable &var)
+{
+        return detail::mix(eVariable, var.symbol);
+}
+
+Uptr UniqueTable::intern(Variable &&var)
+{
+        size_t hash = hash_of(var);
+        return lookup(*this, variables[hash % shards], hash / shards, var.symbol, var);
+}
+
+Uptr UniqueTable::intern(BinaryGrouping &&bg)
+{
+        size_t hash = detail::fingerprint(bg);
+        return lookup(*this, groupings[hash % shards], hash / shards, key_of(bg), bg);
+}
+
+Uptr UniqueTable::intern(NaryGrouping &&ng)
+{
+        size_t hash = detail::fingerprint(ng);
+        return lookup(*this, nary_groupings[hash % shards], hash / shards, key_of(ng), ng);
+}
+
+Uptr UniqueTable::intern(BoxedRational &&br)
+{
+        size_t hash = detail::fingerprint(br.value);
+        return lookup(*this, rationals[hash % shards], hash / shards, key_of(br), br);
+}
+
+// NOTE: The fingerprint of a grouping is the hash it was interned with
+void UniqueTable::forget(const Node *node)
+{
+        size_t hash = node->fingerprint;
+        if (node->kind == eVariable) {
+                hash = hash_of(static_cast <const Variable &> (*node));
+                erase(variables[hash % shards], hash / shards, node);
+        } else if (node->kind == eBinaryGrouping)
+                erase(groupings[hash % shards], hash / shards, node);
+        else if (node->kind == eNaryGrouping)
+                erase(nary_groupings[hash % shards], hash / shards, node);
+        else if (node->kind == eRational)
+                erase(rationals[hash % shards], hash / shards, node);
+}
+
+size_t UniqueTable::size()
+{
+        size_t count = 0;
+
+        auto live = [&](auto &shards) {
+                for (auto &shard : std::span(shards.get(), this->shards)) {
+                        std::lock_guard <std::mutex> lock(shard.mutex);
+                        for (auto &e : shard.entries)
+                                count += e.used && e.node;
+                }
+        };
+
+        live(variables);
+        live(groupings);
+        live(nary_groupings);
+        live(rationals);
+
+        return count;
+}
+
+void UniqueTable::collect()
+{
+        auto collect = [&](auto &shards) {
+                for (auto &shard : std::span(shards.get(), this->shards)) {
+                        std::lock_guard <std::mutex> lock(shard.mutex);
+                        shard.rehash(shard.entries.size());
+                }
+        };
+
+        collect(variables);
+        collect(groupings);
+        collect(nary_groupings);
+        collect(rationals);
+}
+
+void UniqueTable::clear()
+{
+        auto clear = [&](auto &shards) {
+                for (auto &shard : std::span(shards.get(), this->shards)) {
+                        std::lock_guard <std::mutex> lock(shard.mutex);
+                        for (auto &e : shard.entries)
+                                e = {};
+
+                        shard.used = 0;
+                }
+        };
+
+        clear(variables);
+        clear(groupings);
+        clear(nary_groupings);
+        clear(rationals);
+}
+
+namespace detail {
+
+UniqueTable &global_table()
+{
+        // NOTE: Leaked, since nodes may outlive static destruction
+        static UniqueTable *table = new UniqueTable;
+        return *table;
+}
+
+Uptr intern(UniqueTable &table, Variable &&var)
+{
+        return table.intern(std::move(var));
+}
+
+Uptr intern(UniqueTable &table, BinaryGrouping &&bg)
+{
+        return table.intern(std::move(bg));
+}
+
+Uptr intern(UniqueTable &table, NaryGrouping &&ng)
+{
+        return table.intern(std::move(ng));
+}
+
+Uptr intern(UniqueTable &table, BoxedRational &&br)
+{
+        return table.intern(std::move(br));
+}
+
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+// Standard headers
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// Local headers
+#include "operand.hpp"
+
+namespace fermat {
+
+// Hash-consing table; nodes created through the same table are shared
+// whenever they are structurally identical, so that comparing them is only
+// a pointer comparison. Entries do not own their nodes; a node removes its
+// entry once its last reference is released
+struct UniqueTable {
+        // Children are keyed by value if they are constants,
+        // and by address otherwise (since they are unique)
+        struct operand_key {
+                int64_t type;
+                uint64_t bits[2];
+
+                bool operator==(const operand_key &) const = default;
+        };
+
+        struct grouping_key {
+                OperationId op;
+                operand_key a;
+                operand_key b;
+
+                bool operator==(const grouping_key &) const = default;
+        };
+
+        // Refers to the operands of the grouping, so
+        // only compared while its node is alive
+        struct nary_key {
+                OperationId op;
+                std::span <const Operand> opds;
+
+                bool operator==(const nary_key &) const;
+        };
+
+        // Refers to the value of the node, likewise
+        struct rational_key {
+                const Rational *value;
+
+                bool operator==(const rational_key &other) const {
+                        return *value == *other.value;
+                }
+        };
+
+        // Open addressing with linear probing, hashed by the fingerprints
+        // of the nodes; entries of destroyed nodes are only dropped when
+        // the shard grows
+        template <typename K>
+        struct shard {
+                struct entry {
+                        size_t hash;
+                        K key;
+                        Node *node = nullptr;
+                        bool used = false;
+                };
+
+                std::mutex mutex;
+                std::vector <entry> entries;
+                size_t used = 0;
+
+                void rehash(size_t capacity);
+        };
+
+        // Nodes are allocated from the resource, or the heap if null
+        std::pmr::memory_resource *resource;
+
+        // Shards reduce contention when shared between threads
+        size_t shards;
+
+        std::unique_ptr <shard <SymbolId> []> variables;
+        std::unique_ptr <shard <grouping_key> []> groupings;
+        std::unique_ptr <shard <nary_key> []> nary_groupings;
+        std::unique_ptr <shard <rational_key> []> rationals;
+
+        UniqueTable(std::pmr::memory_resource *resource_ = nullptr, size_t shards_ = 16)
+                : resource { resource_ }, shards { shards_ },
+                variables { new shard <SymbolId> [shards_] },
+                groupings { new shard <grouping_key> [shards_] },
+                nary_groupings { new shard <nary_key> [shards_] },
+                rationals { new shard <rational_key> [shards_] } {}
+
+        UniqueTable(const UniqueTable &) = delete;
+        UniqueTable &operator=(const UniqueTable &) = delete;
+
+        // NOTE: The value is moved into the node if one is created
+        Uptr intern(Variable &&);
+        Uptr intern(BinaryGrouping &&);
+        Uptr intern(NaryGrouping &&);
+        Uptr intern(BoxedRational &&);
+
+        // Removes the entry of a node which is being destroyed
+        void forget(const Node *);
+
+        // Number of live nodes
+        size_t size();
+
+        // Drops entries of destroyed nodes
+        void collect();
+
+        // Drops all entries (but keeps the memory); nodes which
+        // are still alive are no longer shared with new ones
+        void clear();
+};
+
+}
@@ -1,15 +1,658 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <random>
+
 #include <benchmark/benchmark.h>
 #include <fermat.hpp>
 
+// Count heap allocations to report allocations per iteration; every
+// throwing form of operator new and delete is replaced (the nothrow
+// forms call these), and all of them allocate through the same pair
+static std::atomic <size_t> g_allocations = 0;
+
+// NOTE: Not inlined, so that the compiler does not pair
+// new-expressions with the calls to malloc and free
+[[gnu::noinline]] static void *allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+{
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+        size = std::max <size_t> (size, 1);
+
+        void *ptr = nullptr;
+        if (alignment <= alignof(std::max_align_t))
+                ptr = std::malloc(size);
+        else
+                ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+
+        if (!ptr)
+                throw std::bad_alloc();
+
+        return ptr;
+}
+
+[[gnu::noinline]] static void deallocate(void *ptr) noexcept
+{
+        std::free(ptr);
+}
+
+void *operator new(size_t size)
+{
+        return allocate(size);
+}
+
+void *operator new[](size_t size)
+{
+        return allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+        return allocate(size, size_t(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+        return allocate(size, size_t(alignment));
+}
+
+void operator delete(void *ptr) noexcept
+{
+        deallocate(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+        deallocate(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+        deallocate(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+        deallocate(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+        deallocate(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+        deallocate(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+        deallocate(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+        deallocate(ptr);
+}
+
 constexpr const char *input = "2 + 6 + 5 * (x - x) + 6/y * y + 5^(z * z) - 12";
 
 static void parsing(benchmark::State &state) {
+        size_t allocations = g_allocations;
         for (auto _ : state)
              fermat::parse(input);
+
+        state.counters["allocations"] = benchmark::Counter(g_allocations - allocations,
+                benchmark::Counter::kAvgIterations);
 }
 
 BENCHMARK(parsing);
 
+static void parsing_arena(benchmark::State &state) {
+        fermat::ExpressionArena arena;
+
+        size_t allocations = g_allocations;
+        size_t nodes = 0;
+        for (auto _ : state) {
+                // Reuse the arena's memory across parses
+                std::optional <fermat::Operand> opd = fermat::parse(input, arena);
+                opd.reset();
+
+                nodes += arena.allocations;
+                arena.release();
+        }
+
+        state.counters["allocations"] = benchmark::Counter(g_allocations - allocations,
+                benchmark::Counter::kAvgIterations);
+        state.counters["arena_allocations"] = benchmark::Counter(nodes,
+                benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(parsing_arena);
+
+constexpr const char *literal_input = "3.14159265358979323846 * 2.718281828459045 + 1234567890123"
+        " - 0.000123e-4 * 6.02214076e23 / 299792458 + 1.602176634e-19 ^ 2"
+        " + 98765.4321 * 0.5 - 42 + 1e10 / 7.25";
+
+static void parsing_literals(benchmark::State &state) {
+        fermat::ExpressionArena arena;
+        for (auto _ : state) {
+                std::optional <fermat::Operand> opd = fermat::parse(literal_input, arena);
+                opd.reset();
+                arena.release();
+        }
+}
+
+BENCHMARK(parsing_literals);
+
+// Random expression with the given number of terms
+static std::string generate_expression(std::mt19937 &rng, int terms)
+{
+        constexpr const char *ops[] = { " + ", " - ", " * ", " / ", "^" };
+        constexpr const char *atoms[] = { "x", "y", "z", "w", "2", "3", "17", "1.5" };
+
+        std::uniform_int_distribution <int> op(0, 4);
+        std::uniform_int_distribution <int> atom(0, 7);
+        std::uniform_int_distribution <int> paren(0, 5);
+
+        std::string expression = atoms[atom(rng)];
+        for (int i = 1; i < terms; i++) {
+                expression += ops[op(rng)];
+                if (paren(rng) == 0) {
+                        expression += "(";
+                        expression += atoms[atom(rng)];
+                        expression += ops[op(rng) % 3];
+                        expression += atoms[atom(rng)];
+                        expression += ")";
+                } else {
+                        expression += atoms[atom(rng)];
+                }
+        }
+
+        return expression;
+}
+
+// Newline delimited corpus of about the given size, written once
+static const std::string &generate_corpus(size_t bytes)
+{
+        static std::string path;
+        if (!path.empty())
+                return path;
+
+        path = (std::filesystem::temp_directory_path() / "fermat_bench_corpus.txt").string();
+
+        std::mt19937 rng(0);
+        std::uniform_int_distribution <int> terms(1, 24);
+
+        std::ofstream file(path);
+        size_t written = 0;
+        while (written < bytes) {
+                std::string expression = generate_expression(rng, terms(rng));
+                file << expression << '\n';
+                written += expression.size() + 1;
+        }
+
+        return path;
+}
+
+static void parsing_long(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        std::string expression = generate_expression(rng, state.range(0));
+
+        fermat::ExpressionArena arena;
+        for (auto _ : state) {
+                std::optional <fermat::Operand> opd = fermat::parse(expression, arena);
+                opd.reset();
+                arena.release();
+        }
+
+        state.SetBytesProcessed(state.iterations() * expression.size());
+}
+
+BENCHMARK(parsing_long)->Arg(2000)->Arg(20000);
+
+// Lexing alone, with (1) and without (0) the vectorized classification
+static void lexing_long(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        std::string expression = generate_expression(rng, 20000);
+
+        std::vector <fermat::Token> tokens;
+        std::string error;
+        for (auto _ : state) {
+                tokens.clear();
+                fermat::detail::tokenize(expression, tokens, error, state.range(0));
+                benchmark::DoNotOptimize(tokens.data());
+        }
+
+        state.SetBytesProcessed(state.iterations() * expression.size());
+}
+
+BENCHMARK(lexing_long)->Arg(0)->Arg(1);
+
+static void parsing_corpus(benchmark::State &state)
+{
+        const std::string &path = generate_corpus(8 << 20);
+        size_t size = std::filesystem::file_size(path);
+
+        size_t arena_bytes = 0;
+        size_t lines = 0;
+        for (auto _ : state) {
+                fermat::ParsedCorpus corpus = fermat::parse_corpus_file(path, state.range(0));
+                benchmark::DoNotOptimize(corpus.roots.data());
+
+                for (const auto &arena : corpus.arenas)
+                        arena_bytes += arena->bytes;
+
+                lines += corpus.roots.size();
+        }
+
+        state.SetBytesProcessed(state.iterations() * size);
+        state.counters["node_bytes_per_line"] = double(arena_bytes) / lines;
+}
+
+BENCHMARK(parsing_corpus)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void simplifying(benchmark::State &state)
+{
+        fermat::Operand opd = fermat::parse(input).value();
+
+        size_t allocations = g_allocations;
+        for (auto _ : state) {
+                fermat::detail::simplification_context sctx;
+                benchmark::DoNotOptimize(fermat::simplify(opd, sctx));
+        }
+
+        state.counters["allocations"] = benchmark::Counter(g_allocations - allocations,
+                benchmark::Counter::kAvgIterations);
+        state.counters["operand_bytes"] = sizeof(fermat::Operand);
+}
+
+BENCHMARK(simplifying);
+
+static void simplifying_long(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        fermat::Operand opd = fermat::parse(generate_expression(rng, state.range(0))).value();
+
+        fermat::detail::simplification_context::statistics stats;
+        for (auto _ : state) {
+                fermat::detail::simplification_context sctx;
+                benchmark::DoNotOptimize(fermat::simplify(opd, sctx));
+
+                stats.hits += sctx.stats.hits;
+                stats.misses += sctx.stats.misses;
+                stats.probes += sctx.stats.probes;
+                stats.longest_probe = std::max(stats.longest_probe, sctx.stats.longest_probe);
+        }
+
+        state.counters["cache_hits"] = benchmark::Counter(stats.hits, benchmark::Counter::kAvgIterations);
+        state.counters["cache_misses"] = benchmark::Counter(stats.misses, benchmark::Counter::kAvgIterations);
+        state.counters["average_probe"] = double(stats.probes) / std::max <size_t> (1, stats.hits + stats.misses);
+        state.counters["longest_probe"] = stats.longest_probe;
+}
+
+BENCHMARK(simplifying_long)->Arg(100)->Arg(2000)->Unit(benchmark::kMillisecond);
+
+// Long expression simplified under a deadline of the given number of
+// microseconds; reports how simple the result is and the budgets used
+static void simplifying_deadline(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        fermat::Operand opd = fermat::parse(generate_expression(rng, 2000)).value();
+
+        fermat::SimplifyUsage usage;
+        int64_t complexity = 0;
+        size_t exhausted = 0;
+        for (auto _ : state) {
+                fermat::SimplifyOptions options;
+                options.deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(state.range(0));
+
+                fermat::Operand simplified = fermat::simplify(opd, options, &usage);
+                complexity = fermat::detail::perceptual_complexity(simplified);
+                exhausted += (usage.exhausted != fermat::eBudgetNone);
+        }
+
+        state.counters["complexity"] = complexity;
+        state.counters["exhausted"] = benchmark::Counter(exhausted, benchmark::Counter::kAvgIterations);
+        state.counters["steps"] = usage.steps;
+        state.counters["memory"] = usage.memory;
+}
+
+BENCHMARK(simplifying_deadline)->Arg(100)->Arg(1000)->Arg(10000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+// Each term is re-simplified once rewritten (x^-2 into 1/x^2), in a scope
+// of the context which by then holds the entries of the terms before it
+static void simplifying_rescoped(benchmark::State &state)
+{
+        std::string expression;
+        for (int i = 0; i < state.range(0); i++) {
+                if (i > 0)
+                        expression += " + ";
+
+                expression += "x" + std::to_string(i) + "^(0 - 2)";
+        }
+
+        fermat::Operand opd = fermat::parse(expression).value();
+
+        size_t entries = 0;
+        for (auto _ : state) {
+                fermat::detail::simplification_context sctx;
+                benchmark::DoNotOptimize(fermat::simplify(opd, sctx));
+                entries = sctx.cache.size();
+        }
+
+        state.counters["entries"] = entries;
+}
+
+BENCHMARK(simplifying_rescoped)->Arg(100)->Arg(1000)->Arg(4000)->Unit(benchmark::kMillisecond);
+
+// Expressions from a small pool, simplified with a memo shared by all
+// threads and iterations, under a budget of the given number of KiB
+static void simplifying_memo(benchmark::State &state)
+{
+        static std::vector <fermat::Operand> pool;
+        static std::unique_ptr <fermat::SimplificationMemo> memo;
+        if (state.thread_index() == 0) {
+                std::mt19937 rng(0);
+                std::uniform_int_distribution <int> terms(2, 12);
+
+                pool.clear();
+                for (int i = 0; i < 256; i++)
+                        pool.push_back(fermat::parse(generate_expression(rng, terms(rng))).value());
+
+                memo = std::make_unique <fermat::SimplificationMemo> (state.range(0) << 10);
+        }
+
+        size_t i = state.thread_index();
+        for (auto _ : state) {
+                fermat::detail::simplification_context sctx;
+                sctx.memo = memo.get();
+                benchmark::DoNotOptimize(fermat::simplify(pool[i++ % pool.size()], sctx));
+        }
+
+        if (state.thread_index() == 0) {
+                fermat::SimplificationMemo::statistics stats = memo->stats();
+                state.counters["hit_rate"] = stats.hit_rate();
+                state.counters["evictions"] = stats.evictions;
+                state.counters["memo_bytes"] = stats.bytes;
+        }
+}
+
+BENCHMARK(simplifying_memo)->Arg(64)->Arg(4096)->Threads(1)->Threads(4)->UseRealTime();
+
+// Balanced tree of sums and products of the given depth, with
+// distinct terms at the bottom; the first of them is the given leaf
+static fermat::Operand generate_nested(int depth, const fermat::Operand &leaf, int64_t &index)
+{
+        static fermat::Operand x = fermat::parse("x").value();
+        static fermat::Operand y = fermat::parse("y").value();
+
+        if (depth == 0) {
+                int64_t i = index++;
+                return (i == 0) ? leaf : x * fermat::Operand(i + 1) + y;
+        }
+
+        fermat::Operand a = generate_nested(depth - 1, leaf, index);
+        fermat::Operand b = generate_nested(depth - 1, leaf, index);
+        return (depth % 2) ? a * b : a + b;
+}
+
+static fermat::Operand generate_nested(int depth, const fermat::Operand &leaf)
+{
+        int64_t index = 0;
+        return generate_nested(depth, leaf, index);
+}
+
+// Re-simplifies an expression after editing its innermost leaf; the
+// argument selects whether subtrees are kept between the calls
+static void simplifying_incremental(benchmark::State &state)
+{
+        fermat::IncrementalSimplifier incremental;
+        incremental.simplify(generate_nested(state.range(0), 0ll));
+
+        int64_t leaf = 1;
+        for (auto _ : state) {
+                state.PauseTiming();
+                fermat::Operand opd = generate_nested(state.range(0), leaf++);
+                state.ResumeTiming();
+
+                if (state.range(1)) {
+                        benchmark::DoNotOptimize(incremental.simplify(opd));
+                } else {
+                        fermat::detail::simplification_context sctx;
+                        benchmark::DoNotOptimize(fermat::simplify(opd, sctx));
+                }
+        }
+
+        state.counters["reused"] = benchmark::Counter(incremental.stats.reused, benchmark::Counter::kAvgIterations);
+        state.counters["simplified"] = benchmark::Counter(incremental.stats.simplified, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(simplifying_incremental)->Args({ 8, 0 })->Args({ 8, 1 })->Unit(benchmark::kMillisecond);
+
+// Large expression simplified on a pool of the given number of workers
+static void simplifying_parallel(benchmark::State &state)
+{
+        fermat::Operand opd = generate_nested(12, fermat::parse("z").value());
+
+        fermat::ThreadPool pool(state.range(0));
+        for (auto _ : state) {
+                fermat::SimplificationMemo memo;
+
+                fermat::detail::simplification_context sctx;
+                sctx.pool = &pool;
+                sctx.memo = &memo;
+                benchmark::DoNotOptimize(fermat::simplify(opd, sctx));
+        }
+
+        state.counters["nodes"] = fermat::detail::size(opd);
+}
+
+BENCHMARK(simplifying_parallel)->RangeMultiplier(2)->Range(1, 32)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Sum of the given number of random monomials in a few variables,
+// so that most of them are like terms of one another
+static std::string generate_polynomial(std::mt19937 &rng, int terms)
+{
+        constexpr const char *variables[] = { "x", "y", "z" };
+
+        std::uniform_int_distribution <int> coefficient(1, 9);
+        std::uniform_int_distribution <int> exponent(0, 3);
+
+        std::string expression;
+        for (int i = 0; i < terms; i++) {
+                if (i > 0)
+                        expression += " + ";
+
+                expression += std::to_string(coefficient(rng));
+                for (const char *variable : variables) {
+                        if (int e = exponent(rng))
+                                expression += std::string(" * ") + variable + "^" + std::to_string(e);
+                }
+        }
+
+        return expression;
+}
+
+static void simplifying_polynomial(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        fermat::Operand opd = fermat::parse(generate_polynomial(rng, state.range(0))).value();
+
+        size_t terms = 0;
+        for (auto _ : state) {
+                fermat::detail::simplification_context sctx;
+                fermat::Operand simplified = fermat::simplify(opd, sctx);
+                terms = simplified.is_sum() ? simplified.as_nary_grouping().opds.size() : 1;
+        }
+
+        state.counters["terms"] = terms;
+}
+
+BENCHMARK(simplifying_polynomial)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+// Sum of the given number of terms c * k^x, with few distinct bases, so
+// that like terms are gathered rather than combined as polynomials
+static void simplifying_gather(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        std::uniform_int_distribution <int> coefficient(1, 9);
+        std::uniform_int_distribution <int> base(2, 33);
+
+        std::string expression;
+        for (int i = 0; i < state.range(0); i++) {
+                if (i > 0)
+                        expression += " + ";
+
+                expression += std::to_string(coefficient(rng)) + " * " + std::to_string(base(rng)) + "^x";
+        }
+
+        fermat::Operand opd = fermat::parse(expression).value();
+
+        size_t terms = 0;
+        for (auto _ : state) {
+                fermat::detail::simplification_context sctx;
+                fermat::Operand simplified = fermat::simplify(opd, sctx);
+                terms = simplified.is_sum() ? simplified.as_nary_grouping().opds.size() : 1;
+        }
+
+        state.counters["terms"] = terms;
+}
+
+BENCHMARK(simplifying_gather)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void simplifying_egraph(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        fermat::Operand opd = fermat::parse(generate_expression(rng, state.range(0))).value();
+
+        size_t nodes = 0;
+        size_t iterations = 0;
+        for (auto _ : state) {
+                fermat::EGraph egraph;
+                fermat::EClassId root = egraph.add(fermat::detail::canonical(opd));
+                egraph.saturate();
+                benchmark::DoNotOptimize(egraph.extract(root));
+
+                nodes += egraph.nodes;
+                iterations += egraph.iterations;
+        }
+
+        state.counters["enodes"] = benchmark::Counter(nodes, benchmark::Counter::kAvgIterations);
+        state.counters["iterations"] = benchmark::Counter(iterations, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(simplifying_egraph)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
+
+// Only the candidate rules of each expression are tried, so the
+// time per expression should not grow with the number of rules
+static void rewriting_rules(benchmark::State &state)
+{
+        fermat::RewriteSystem system;
+        for (int k = 0; k < state.range(0); k++) {
+                std::string exponent = std::to_string(k + 2);
+                system.add({ "power " + exponent, "x^" + exponent, "x * x^(" + exponent + " - 1)" });
+        }
+
+        std::vector <fermat::Operand> subjects;
+        for (int j = 0; j < 64; j++) {
+                subjects.push_back(fermat::parse("a^" + std::to_string(j + 1) + " * b").value());
+                subjects.push_back(fermat::parse("(a + b)^" + std::to_string(j + 1)).value());
+        }
+
+        size_t rewritten = 0;
+        for (auto _ : state) {
+                rewritten = 0;
+                for (const fermat::Operand &opd : subjects)
+                        rewritten += system.rewrite(opd).has_value();
+        }
+
+        state.counters["rewritten"] = rewritten;
+        state.SetItemsProcessed(state.iterations() * subjects.size());
+}
+
+BENCHMARK(rewriting_rules)->Arg(10)->Arg(100)->Arg(1000);
+
+// Folds c + a/b over random digits: exactly with machine integers (a*b
+// instead of a/b), exactly with rationals, and with long doubles as before
+static void folding_constants(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        std::uniform_int_distribution <int> digit(1, 9);
+
+        std::vector <fermat::Operand> as;
+        std::vector <fermat::Operand> bs;
+        for (int i = 0; i < 1000; i++) {
+                as.push_back(state.range(0) == 2 ? fermat::Operand(fermat::Real(digit(rng))) : digit(rng));
+                bs.push_back(state.range(0) == 2 ? fermat::Operand(fermat::Real(digit(rng))) : digit(rng));
+        }
+
+        fermat::Operation *op = (state.range(0) == 0) ? fermat::op_mul : fermat::op_div;
+
+        fermat::Operand c;
+        for (auto _ : state) {
+                c = 0;
+                for (size_t i = 0; i < as.size(); i++)
+                        c = fermat::opftn(fermat::op_add, c, fermat::opftn(op, as[i], bs[i]));
+
+                benchmark::DoNotOptimize(c);
+        }
+
+        state.SetLabel(c.string());
+        state.SetItemsProcessed(2 * state.iterations() * as.size());
+}
+
+BENCHMARK(folding_constants)->Arg(0)->Arg(1)->Arg(2);
+
+// Long chains of integers, reals and rationals
+static void folding_chain(benchmark::State &state)
+{
+        std::mt19937 rng(0);
+        std::uniform_int_distribution <int> digit(1, 9);
+
+        std::vector <fermat::Operand> opds;
+        for (int i = 0; i < state.range(0); i++) {
+                if (state.range(1) == 0)
+                        opds.push_back(digit(rng));
+                else if (state.range(1) == 1)
+                        opds.push_back(fermat::Real(digit(rng)) / 2);
+                else
+                        opds.push_back(fermat::opftn(fermat::op_div, digit(rng), 2));
+        }
+
+        for (auto _ : state)
+                benchmark::DoNotOptimize(fermat::fold(fermat::op_add, opds));
+
+        state.SetItemsProcessed(state.iterations() * opds.size());
+}
+
+BENCHMARK(folding_chain)->Args({ 10000, 0 })->Args({ 10000, 1 })->Args({ 10000, 2 });
+
+// Queries on deep trees, whose metadata is cached in the nodes
+static void querying_deep(benchmark::State &state)
+{
+        fermat::Operand opd = fermat::parse("x").value();
+        for (int i = 0; i < state.range(0); i++)
+                opd = (opd * (i + 2)) + fermat::Operand { i + 1 };
+
+        for (auto _ : state) {
+                benchmark::DoNotOptimize(fermat::detail::perceptual_complexity(opd));
+                benchmark::DoNotOptimize(fermat::detail::is_constant(opd));
+                benchmark::DoNotOptimize(fermat::detail::hash(opd));
+        }
+
+        state.counters["depth"] = fermat::detail::depth(opd);
+}
+
+BENCHMARK(querying_deep)->Arg(100)->Arg(10000);
+
 static void evaluate_partially_evaluated(benchmark::State &state)
 {
         fermat::Operand result = fermat::parse(input).value();
@@ -22,6 +665,20 @@ static void evaluate_partially_evaluated(benchmark::State &state)
 
 BENCHMARK(evaluate_partially_evaluated);
 
+// One expression shared by all threads, with different values each
+static void evaluate_partially_evaluated_shared(benchmark::State &state)
+{
+        static const fermat::PartiallyEvaluated pe = fermat::partially_evaluate(fermat::parse(input).value());
+
+        fermat::Integer x = state.thread_index();
+        for (auto _ : state)
+                benchmark::DoNotOptimize(pe(x++, 2, 3));
+
+        state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(evaluate_partially_evaluated_shared)->ThreadRange(1, 8)->UseRealTime();
+
 static void evaluate_jit_base(benchmark::State &state)
 {
         fermat::Operand result = fermat::parse(input).value();